@@ -0,0 +1,67 @@
+#!/bin/sh
+
+#
+# Training run for a profile-guided build that exercises the code paths of
+# a production engine: every personality found under perGM/, the opening book
+# and time-managed searches, on top of the usual bench positions.
+#
+# Usage (from the src directory):
+#   make -j profile-build ARCH=x86-64-avx2 PGOSCRIPT=../scripts/pgo_training.sh
+#   sh ../scripts/pgo_training.sh ./hypnos [depth]
+#
+
+engine=${1:-./hypnos}
+depth=${2:-13}
+book=books/default.bin
+
+personalities=
+if [ -d perGM ]; then
+  personalities=$(cd perGM && find . -name '*.json' | sed 's|^\./||; s|\.json$||' | sort)
+fi
+
+# Without personalities, train on the default one with the usual bench only
+if [ -z "$personalities" ]; then
+  echo "No personality found under perGM/, running the plain bench" >&2
+  out=$($engine bench 2>&1) && echo "$out" | grep -q '^Nodes searched' || { echo "$out" >&2; exit 1; }
+  echo "$out" | grep -E '^(Nodes searched|Nodes/second)'
+  exit 0
+fi
+
+commands() {
+  for p in $personalities; do
+    echo "setoption name Load Personality value $p"
+
+    if [ -f "$book" ]; then
+      echo "setoption name Book File value $book"
+      echo "setoption name PersonalityBook value true"
+      echo "setoption name Book Depth value 8"
+    fi
+
+    # Book probes and time-managed searches of an opening sequence
+    echo "ucinewgame"
+    echo "position startpos"
+    echo "go wtime 2000 btime 2000 winc 20 binc 20"
+    echo "position startpos moves e2e4 e7e5 g1f3 b8c6"
+    echo "go wtime 2000 btime 2000 winc 20 binc 20"
+    echo "position startpos moves d2d4 g8f6 c2c4 e7e6 b1c3 f8b4"
+    echo "go wtime 1500 btime 1500 winc 20 binc 20"
+    echo "position fen r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP2BPPP/R2QKB1R w KQ - 0 9"
+    echo "go wtime 3000 btime 3000 winc 30 binc 30"
+
+    # Bench waits for the search above, then covers the middlegame and endgame
+    echo "bench 16 1 $depth"
+  done
+  echo "quit"
+}
+
+# Fail on a crash or when a bench did not complete, so the profile is not
+# built from a partial run
+out=$(commands | $engine 2>&1) || { echo "$out" >&2; exit 1; }
+
+echo "$out" | grep -E '^(Nodes searched|Nodes/second|info string Personality loaded)'
+
+runs=$(echo "$out" | grep -c '^Nodes searched')
+if [ "$runs" -ne "$(echo "$personalities" | wc -l)" ]; then
+  echo "$out" >&2
+  exit 1
+fi
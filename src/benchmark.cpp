@@ -18,12 +18,30 @@
 
 #include "benchmark.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <deque>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <istream>
+#include <memory>
+#include <sstream>
 #include <vector>
 
+#include "evaluate.h"
+#include "misc.h"
+#include "movegen.h"
+#include "movepick.h"
+#include "polybook.h"
 #include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "tt.h"
+#include "uci.h"
+#include "nlohmann/json.hpp"
 
 using namespace std;
 
@@ -168,4 +186,275 @@ for (const string& fen : fens)
 return list;
 }
 
+namespace {
+
+  // A position of the bench suite, with the states of the moves that led to it
+  struct SuitePosition {
+    StateListPtr states;
+    std::unique_ptr<Position> pos;
+  };
+
+  vector<SuitePosition> suite_positions() {
+
+    vector<SuitePosition> positions;
+    bool chess960 = false;
+
+    for (const string& line : Defaults)
+    {
+        if (line.find("setoption") != string::npos)
+        {
+            chess960 = line.find("value true") != string::npos;
+            continue;
+        }
+
+        size_t movesIdx = line.find(" moves ");
+        SuitePosition sp { StateListPtr(new std::deque<StateInfo>(1)), std::make_unique<Position>() };
+        sp.pos->set(line.substr(0, movesIdx), chess960, &sp.states->back(), Threads.main());
+
+        if (movesIdx != string::npos)
+        {
+            istringstream ss(line.substr(movesIdx + 7));
+            string token;
+            Move m;
+
+            while (ss >> token && (m = UCI::to_move(*sp.pos, token)) != MOVE_NONE)
+            {
+                sp.states->emplace_back();
+                sp.pos->do_move(m, sp.states->back());
+            }
+        }
+
+        positions.push_back(std::move(sp));
+    }
+
+    return positions;
+  }
+
+  // Plain perft without the perft hash, so that it measures move generation
+  // and do_move()/undo_move() only.
+  uint64_t suite_perft(Position& pos, Depth depth) {
+
+    if (depth == 1)
+        return MoveList<LEGAL>(pos).size();
+
+    StateInfo st;
+    uint64_t nodes = 0;
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+    {
+        pos.do_move(m, st);
+        nodes += suite_perft(pos, depth - 1);
+        pos.undo_move(m);
+    }
+
+    return nodes;
+  }
+
+  // Runs a kernel the given number of times. The kernel returns the number of
+  // operations it did and adds its results to the checksum, which keeps the
+  // compiler from discarding the work and lets a CI spot a behaviour change.
+  template<typename Kernel>
+  nlohmann::ordered_json measure(int runs, Kernel kernel) {
+
+    vector<double> nsPerOp;
+    uint64_t ops = 0, checksum = 0;
+
+    for (int r = 0; r < runs; ++r)
+    {
+        checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        ops = kernel(checksum);
+        auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        nsPerOp.push_back(ns / std::max(ops, uint64_t(1)));
+    }
+
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    auto percentile = [&](int p) { return nsPerOp[(nsPerOp.size() - 1) * p / 100]; };
+    auto round2 = [](double v) { return std::round(v * 100) / 100; };
+
+    nlohmann::ordered_json result;
+    result["ops"]         = ops;
+    result["checksum"]    = checksum;
+    result["ns_per_op"]   = {
+        { "median", round2(percentile(50)) },
+        { "p10",    round2(percentile(10)) },
+        { "p90",    round2(percentile(90)) },
+        { "min",    round2(nsPerOp.front()) },
+        { "max",    round2(nsPerOp.back()) }
+    };
+    return result;
+  }
+
+  // Personality files found under perGM/, relative to it and without extension
+  vector<string> personality_files() {
+
+    vector<string> files;
+    std::error_code ec;
+
+    for (auto it = std::filesystem::recursive_directory_iterator("perGM", ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+        if (it->path().extension() == ".json")
+            files.push_back(it->path().lexically_relative("perGM").replace_extension().generic_string());
+
+    std::sort(files.begin(), files.end());
+    return files;
+  }
+
+} // namespace
+
+/// bench_suite() runs microbenchmarks of the main search kernels on the bench
+/// positions and prints the results as JSON, with the median and percentiles
+/// of the time per operation over several runs and a description of the build
+/// and of the machine, so that results can be compared across commits.
+///
+/// benchsuite [runs N] [perft D]
+
+void bench_suite(istream& is) {
+
+  int runs = 9, perftDepth = 5;
+  string token;
+
+  while (is >> token)
+      if (token == "runs" && is >> runs)
+          runs = std::max(runs, 1);
+      else if (token == "perft" && is >> perftDepth)
+          perftDepth = std::clamp(perftDepth, 1, 7);
+
+  Search::clear();
+
+  vector<SuitePosition> positions = suite_positions();
+  vector<Position*> quiet; // Positions not in check, as evaluate() requires
+
+  for (auto& sp : positions)
+      if (!sp.pos->checkers())
+          quiet.push_back(sp.pos.get());
+
+  nlohmann::ordered_json out, kernels;
+
+  string engine = engine_info(true), compiler = compiler_info();
+  engine = engine.substr(0, engine.find('\n'));
+  engine.erase(engine.find_last_not_of(' ') + 1);
+  compiler.erase(0, compiler.find_first_not_of('\n'));
+  compiler.erase(compiler.find_last_not_of('\n') + 1);
+
+  out["engine"] = engine;
+  out["machine"] = {
+      { "cpu",      SysInfo::processor_brand() },
+      { "cores",    SysInfo::logical_cores() },
+      { "memory",   SysInfo::total_memory() },
+      { "os",       SysInfo::os_info() },
+      { "compiler", compiler }
+  };
+  out["runs"] = runs;
+  out["positions"] = positions.size();
+
+  kernels["movegen_legal"] = measure(runs, [&](uint64_t& sum) {
+      uint64_t ops = 0;
+      for (int i = 0; i < 2000; ++i)
+          for (auto& sp : positions)
+              sum += MoveList<LEGAL>(*sp.pos).size(), ++ops;
+      return ops;
+  });
+
+  kernels["do_undo_move"] = measure(runs, [&](uint64_t& sum) {
+      uint64_t ops = 0;
+      StateInfo st;
+      for (int i = 0; i < 200; ++i)
+          for (auto& sp : positions)
+              for (const auto& m : MoveList<LEGAL>(*sp.pos))
+              {
+                  sp.pos->do_move(m, st);
+                  sum += sp.pos->key() & 0xFF;
+                  sp.pos->undo_move(m);
+                  ++ops;
+              }
+      return ops;
+  });
+
+  kernels["see_ge"] = measure(runs, [&](uint64_t& sum) {
+      uint64_t ops = 0;
+      for (int i = 0; i < 500; ++i)
+          for (auto& sp : positions)
+              for (const auto& m : MoveList<LEGAL>(*sp.pos))
+                  sum += sp.pos->see_ge(m), ++ops;
+      return ops;
+  });
+
+  // The histories of a new pool are cleared at its first search, which the
+  // move picker kernel must not run ahead of.
+  if (Threads.main()->history_pending())
+      Threads.main()->clear();
+
+  kernels["move_picker"] = measure(runs, [&](uint64_t& sum) {
+      uint64_t ops = 0;
+      Thread* th = Threads.main();
+      const PieceToHistory* contHist[] = { &th->continuationHistory[0][0][NO_PIECE][0], &th->continuationHistory[0][0][NO_PIECE][0],
+                                           &th->continuationHistory[0][0][NO_PIECE][0], &th->continuationHistory[0][0][NO_PIECE][0],
+                                           &th->continuationHistory[0][0][NO_PIECE][0], &th->continuationHistory[0][0][NO_PIECE][0] };
+      Move killers[2] = { MOVE_NONE, MOVE_NONE };
+
+      for (int i = 0; i < 500; ++i)
+          for (auto& sp : positions)
+          {
+              MovePicker mp(*sp.pos, MOVE_NONE, 10, &th->mainHistory, &th->captureHistory,
+                            contHist, MOVE_NONE, killers);
+              for (Move m; (m = mp.next_move()) != MOVE_NONE; ++ops)
+                  sum += from_to(m);
+          }
+      return ops;
+  });
+
+  kernels["tt_probe"] = measure(runs, [&](uint64_t& sum) {
+      PRNG rng(1070372);
+      bool found;
+      for (int i = 0; i < (1 << 20); ++i)
+          sum += TT.probe(rng.rand<Key>(), found) != nullptr && found;
+      return uint64_t(1 << 20);
+  });
+
+  kernels["book_probe"] = measure(runs, [&](uint64_t& sum) {
+      uint64_t ops = 0;
+      PolyBook::seed(1070372); // Same book moves, so the same checksum, on every run
+      for (int i = 0; i < 1000; ++i)
+          for (auto& sp : positions)
+              sum += polybook[0].probe(*sp.pos, 1), ++ops;
+      return ops;
+  });
+  kernels["book_probe"]["book"] = string(Options["Book File"]);
+  PolyBook::seed(uint64_t(time(nullptr)));
+
+  kernels["perft"] = measure(runs, [&](uint64_t& sum) {
+      uint64_t nodes = suite_perft(*positions[0].pos, perftDepth)
+                     + suite_perft(*positions[1].pos, std::max(perftDepth - 1, 1));
+      sum += nodes;
+      return nodes;
+  });
+  kernels["perft"]["depth"] = perftDepth;
+
+  // The evaluation with the current parameters, then with each personality
+  auto evaluate = [&](uint64_t& sum) {
+      uint64_t ops = 0;
+      for (int i = 0; i < 1000; ++i)
+          for (Position* pos : quiet)
+              sum += uint64_t(Eval::evaluate(*pos)), ++ops;
+      return ops;
+  };
+
+  kernels["evaluate"] = measure(runs, evaluate);
+
+  Personality saved = Eval::activePersonality;
+  std::streambuf* coutBuf = cout.rdbuf(nullptr); // Silence the loader messages
+
+  for (const string& file : personality_files())
+      if (Eval::activePersonality.load_from_file("perGM/" + file + ".json"))
+          kernels["evaluate/" + file] = measure(runs, evaluate);
+
+  cout.rdbuf(coutBuf);
+  Eval::activePersonality = saved;
+
+  out["kernels"] = kernels;
+
+  sync_cout << out.dump(2) << sync_endl;
+}
+
 } // namespace Hypnos
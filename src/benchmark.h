@@ -28,6 +28,7 @@ namespace Hypnos {
 class Position;
 
 std::vector<std::string> setup_bench(const Position&, std::istream&);
+void bench_suite(std::istream&);
 
 } // namespace Hypnos
 
@@ -19,6 +19,7 @@
 #include <cassert>
 #include <vector>
 #include <bitset>
+#include <mutex>
 
 #include "bitboard.h"
 #include "types.h"
@@ -32,6 +33,9 @@ namespace {
   constexpr unsigned MAX_INDEX = 2*24*64*64; // stm * psq * wksq * bksq = 196608
 
   std::bitset<MAX_INDEX> KPKBitbase;
+  std::once_flag KPKBuilt;
+
+  void build_kpk();
 
   // A KPK bitbase index is an integer in [0, IndexMax] range
   //
@@ -72,32 +76,43 @@ bool Bitbases::probe(Square wksq, Square wpsq, Square bksq, Color stm) {
 
   assert(file_of(wpsq) <= FILE_D);
 
+  init();
+
   return KPKBitbase[index(stm, bksq, wksq, wpsq)];
 }
 
 
+/// Bitbases::init() builds the KPK bitbase the first time it is called. The
+/// build takes several milliseconds, so it is done on the first probe rather
+/// than at startup: most games never reach a KPK ending.
+
 void Bitbases::init() {
 
-  std::vector<KPKPosition> db(MAX_INDEX);
-  unsigned idx, repeat = 1;
+  std::call_once(KPKBuilt, build_kpk);
+}
+
+namespace {
 
-  // Initialize db with known win / draw positions
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      db[idx] = KPKPosition(idx);
+  void build_kpk() {
 
-  // Iterate through the positions until none of the unknown positions can be
-  // changed to either wins or draws (15 cycles needed).
-  while (repeat)
-      for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
-          repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+    std::vector<KPKPosition> db(MAX_INDEX);
+    unsigned idx, repeat = 1;
 
-  // Fill the bitbase with the decisive results
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      if (db[idx] == WIN)
-          KPKBitbase.set(idx);
-}
+    // Initialize db with known win / draw positions
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        db[idx] = KPKPosition(idx);
 
-namespace {
+    // Iterate through the positions until none of the unknown positions can be
+    // changed to either wins or draws (15 cycles needed).
+    while (repeat)
+        for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
+            repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+
+    // Fill the bitbase with the decisive results
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        if (db[idx] == WIN)
+            KPKBitbase.set(idx);
+  }
 
   KPKPosition::KPKPosition(unsigned idx) {
 
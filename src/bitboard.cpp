@@ -18,6 +18,15 @@
 
 #include <algorithm>
 #include <bitset>
+#include <cstdio>
+#include <filesystem>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "bitboard.h"
 #include "misc.h"
@@ -41,6 +50,8 @@ namespace {
   Bitboard BishopTable[0x1480]; // To store bishop attacks
 
   void init_magics(PieceType pt, Bitboard table[], Magic magics[]);
+  bool map_shared_magics();
+  void save_shared_magics();
 
 }
 
@@ -74,9 +85,11 @@ std::string Bitboards::pretty(Bitboard b) {
 
 
 /// Bitboards::init() initializes various bitboard tables. It is called at
-/// startup and relies on global objects to be already zero-initialized.
+/// startup and relies on global objects to be already zero-initialized. With
+/// 'shareTables' the slider attack tables, the bulk of the static data, are
+/// mapped read-only from a file shared by all the engine processes on the host.
 
-void Bitboards::init() {
+void Bitboards::init(bool shareTables) {
 
   for (unsigned i = 0; i < (1 << 16); ++i)
       PopCnt16[i] = uint8_t(std::bitset<16>(i).count());
@@ -85,8 +98,14 @@ void Bitboards::init() {
       for (Square s2 = SQ_A1; s2 <= SQ_H8; ++s2)
           SquareDistance[s1][s2] = std::max(distance<File>(s1, s2), distance<Rank>(s1, s2));
 
-  init_magics(ROOK, RookTable, RookMagics);
-  init_magics(BISHOP, BishopTable, BishopMagics);
+  if (!shareTables || !map_shared_magics())
+  {
+      init_magics(ROOK, RookTable, RookMagics);
+      init_magics(BISHOP, BishopTable, BishopMagics);
+
+      if (shareTables)
+          save_shared_magics();
+  }
 
   for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
   {
@@ -134,6 +153,47 @@ namespace {
   }
 
 
+  // Magics found by the seeded search below for 64 bit builds without pext.
+  // They never change, so the search, the bulk of the startup time, is skipped
+  // and only the attack tables are filled in.
+  constexpr Bitboard RookMagicNumbers[SQUARE_NB] = {
+    0x0A80004000801220ULL, 0x8040004010002008ULL, 0x2080200010008008ULL, 0x1100100008210004ULL,
+    0xC200209084020008ULL, 0x2100010004000208ULL, 0x0400081000822421ULL, 0x0200010422048844ULL,
+    0x0800800080400024ULL, 0x0001402000401000ULL, 0x3000801000802001ULL, 0x4400800800100083ULL,
+    0x0904802402480080ULL, 0x4040800400020080ULL, 0x0018808042000100ULL, 0x4040800080004100ULL,
+    0x0040048001458024ULL, 0x00A0004000205000ULL, 0x3100808010002000ULL, 0x4825010010000820ULL,
+    0x5004808008000401ULL, 0x2024818004000A00ULL, 0x0005808002000100ULL, 0x2100060004806104ULL,
+    0x0080400880008421ULL, 0x4062220600410280ULL, 0x010A004A00108022ULL, 0x0000100080080080ULL,
+    0x0021000500080010ULL, 0x0044000202001008ULL, 0x0000100400080102ULL, 0xC020128200040545ULL,
+    0x0080002000400040ULL, 0x0000804000802004ULL, 0x0000120022004080ULL, 0x010A386103001001ULL,
+    0x9010080080800400ULL, 0x8440020080800400ULL, 0x0004228824001001ULL, 0x000000490A000084ULL,
+    0x0080002000504000ULL, 0x200020005000C000ULL, 0x0012088020420010ULL, 0x0010010080080800ULL,
+    0x0085001008010004ULL, 0x0002000204008080ULL, 0x0040413002040008ULL, 0x0000304081020004ULL,
+    0x0080204000800080ULL, 0x3008804000290100ULL, 0x1010100080200080ULL, 0x2008100208028080ULL,
+    0x5000850800910100ULL, 0x8402019004680200ULL, 0x0120911028020400ULL, 0x0000008044010200ULL,
+    0x0020850200244012ULL, 0x0020850200244012ULL, 0x0000102001040841ULL, 0x140900040A100021ULL,
+    0x000200282410A102ULL, 0x000200282410A102ULL, 0x000200282410A102ULL, 0x4048240043802106ULL
+  };
+
+  constexpr Bitboard BishopMagicNumbers[SQUARE_NB] = {
+    0x40106000A1160020ULL, 0x0020010250810120ULL, 0x2010010220280081ULL, 0x002806004050C040ULL,
+    0x0002021018000000ULL, 0x2001112010000400ULL, 0x0881010120218080ULL, 0x1030820110010500ULL,
+    0x0000120222042400ULL, 0x2000020404040044ULL, 0x8000480094208000ULL, 0x0003422A02000001ULL,
+    0x000A220210100040ULL, 0x8004820202226000ULL, 0x0018234854100800ULL, 0x0100004042101040ULL,
+    0x0004001004082820ULL, 0x0010000810010048ULL, 0x1014004208081300ULL, 0x2080818802044202ULL,
+    0x0040880C00A00100ULL, 0x0080400200522010ULL, 0x0001000188180B04ULL, 0x0080249202020204ULL,
+    0x1004400004100410ULL, 0x00013100A0022206ULL, 0x2148500001040080ULL, 0x4241080011004300ULL,
+    0x4020848004002000ULL, 0x10101380D1004100ULL, 0x0008004422020284ULL, 0x01010A1041008080ULL,
+    0x0808080400082121ULL, 0x0808080400082121ULL, 0x0091128200100C00ULL, 0x0202200802010104ULL,
+    0x8C0A020200440085ULL, 0x01A0008080B10040ULL, 0x0889520080122800ULL, 0x100902022202010AULL,
+    0x04081A0816002000ULL, 0x0000681208005000ULL, 0x8170840041008802ULL, 0x0A00004200810805ULL,
+    0x0830404408210100ULL, 0x2602208106006102ULL, 0x1048300680802628ULL, 0x2602208106006102ULL,
+    0x0602010120110040ULL, 0x0941010801043000ULL, 0x000040440A210428ULL, 0x0008240020880021ULL,
+    0x0400002012048200ULL, 0x00AC102001210220ULL, 0x0220021002009900ULL, 0x84440C080A013080ULL,
+    0x0001008044200440ULL, 0x0004C04410841000ULL, 0x2000500104011130ULL, 0x1A0C010011C20229ULL,
+    0x0044800112202200ULL, 0x0434804908100424ULL, 0x0300404822C08200ULL, 0x48081010008A2A80ULL
+  };
+
   // init_magics() computes all rook and bishop attacks at startup. Magic
   // bitboards are used to look up attacks of sliding pieces. As a reference see
   // www.chessprogramming.org/Magic_Bitboards. In particular, here we use the so
@@ -183,6 +243,16 @@ namespace {
         if (HasPext)
             continue;
 
+        if (Is64Bit)
+        {
+            m.magic = (pt == ROOK ? RookMagicNumbers : BishopMagicNumbers)[s];
+
+            for (int i = 0; i < size; ++i)
+                m.attacks[m.index(occupancy[i])] = reference[i];
+
+            continue;
+        }
+
         PRNG rng(seeds[Is64Bit][rank_of(s)]);
 
         // Find a magic for square 's' picking up an (almost) random number
@@ -213,6 +283,207 @@ namespace {
         }
     }
   }
+
+  // The shared magics file holds the magics of both slider types followed by
+  // their attack tables. It depends on how the magics are indexed, so the name
+  // and the header encode the pext and the 64 bit flags.
+
+  struct SharedMagicsHeader {
+    uint64_t signature;
+    uint64_t flags;
+  };
+
+  struct SharedMagic {
+    Bitboard mask, magic;
+    uint64_t offset, shift;
+  };
+
+  constexpr uint64_t SharedMagicsSignature = 0x48594D4147494301ULL; // "HYMAGIC" v1
+  constexpr uint64_t SharedMagicsFlags = uint64_t(HasPext) | uint64_t(Is64Bit) << 1;
+  constexpr size_t SharedMagicsSize =  sizeof(SharedMagicsHeader)
+                                     + 2 * SQUARE_NB * sizeof(SharedMagic)
+                                     + sizeof(RookTable) + sizeof(BishopTable);
+
+  // The file lives in a directory of the user's own in the temp directory.
+  // Whatever is found there is only trusted if the user owns it and nobody
+  // else can write to it.
+
+  std::string shared_magics_dir() {
+
+#if defined(_WIN32)
+    return std::string();
+#else
+    std::error_code ec;
+    std::filesystem::path dir = std::filesystem::temp_directory_path(ec);
+    if (ec)
+        return std::string();
+
+    std::string path = (dir / ("hypnos-" + std::to_string(getuid()))).string();
+    mkdir(path.c_str(), 0700);
+
+    struct stat st;
+    if (   lstat(path.c_str(), &st) != 0
+        || !S_ISDIR(st.st_mode)
+        ||  st.st_uid != getuid()
+        || (st.st_mode & (S_IWGRP | S_IWOTH)))
+        return std::string();
+
+    return path;
+#endif
+  }
+
+#if !defined(_WIN32)
+  std::string shared_magics_path(const std::string& dir) {
+    return dir + "/hypnos-magics-" + std::to_string(SharedMagicsFlags) + ".bin";
+  }
+
+
+  // valid_shared_magics() checks the magics and tables of a shared file. The
+  // mask, shift and offset of a square follow from the square alone, so they
+  // are recomputed, not trusted, which keeps every lookup within the tables.
+  // Then each entry reachable from each square is checked against the sliding
+  // attack it stands for, so that a stale or tampered file is never adopted.
+
+  bool valid_shared_magics(const SharedMagic* sm, const Bitboard* tables) {
+
+    uint64_t offset = 0;
+
+    for (PieceType pt : { ROOK, BISHOP })
+        for (Square s = SQ_A1; s <= SQ_H8; ++s, ++sm)
+        {
+            Bitboard edges = ((Rank1BB | Rank8BB) & ~rank_bb(s)) | ((FileABB | FileHBB) & ~file_bb(s));
+            Bitboard mask  = sliding_attack(pt, s, 0) & ~edges;
+            unsigned shift = (Is64Bit ? 64 : 32) - popcount(mask);
+
+            if (   sm->mask != mask
+                || sm->shift != shift
+                || sm->offset != offset
+                || (Is64Bit && !HasPext && sm->magic != (pt == ROOK ? RookMagicNumbers : BishopMagicNumbers)[s]))
+                return false;
+
+            Magic m = { mask, sm->magic, const_cast<Bitboard*>(tables + offset), shift };
+            Bitboard b = 0;
+            do {
+                if (m.attacks[m.index(b)] != sliding_attack(pt, s, b))
+                    return false;
+                b = (b - mask) & mask;
+            } while (b);
+
+            offset += uint64_t(1) << popcount(mask);
+        }
+
+    return offset == std::size(RookTable) + std::size(BishopTable);
+  }
+
+
+#endif
+
+  // map_shared_magics() maps the shared magics file, if a valid one exists, and
+  // points the magics into it. The mapping is kept until the process exits.
+
+  bool map_shared_magics() {
+
+#if defined(_WIN32)
+    return false;
+#else
+    std::string dir = shared_magics_dir();
+    if (dir.empty())
+        return false;
+
+    std::string path = shared_magics_path(dir);
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void* mem = MAP_FAILED;
+
+    if (   fstat(fd, &st) == 0
+        && S_ISREG(st.st_mode)
+        && st.st_uid == getuid()
+        && !(st.st_mode & (S_IWGRP | S_IWOTH))
+        && size_t(st.st_size) == SharedMagicsSize)
+        mem = mmap(nullptr, SharedMagicsSize, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (mem == MAP_FAILED)
+        return false;
+
+    const SharedMagicsHeader* header = static_cast<const SharedMagicsHeader*>(mem);
+    const SharedMagic* sm = reinterpret_cast<const SharedMagic*>(header + 1);
+    Bitboard* tables = const_cast<Bitboard*>(reinterpret_cast<const Bitboard*>(sm + 2 * SQUARE_NB));
+
+    if (   header->signature != SharedMagicsSignature
+        || header->flags != SharedMagicsFlags
+        || !valid_shared_magics(sm, tables))
+    {
+        munmap(mem, SharedMagicsSize);
+        return false;
+    }
+
+    for (Magic* magics : { RookMagics, BishopMagics })
+        for (Square s = SQ_A1; s <= SQ_H8; ++s, ++sm)
+        {
+            magics[s].mask    = sm->mask;
+            magics[s].magic   = sm->magic;
+            magics[s].attacks = tables + sm->offset;
+            magics[s].shift   = unsigned(sm->shift);
+        }
+
+    return true;
+#endif
+  }
+
+
+  // save_shared_magics() writes the freshly computed magics for the next engine
+  // processes. The file is written under a fresh name made by mkstemp(), which
+  // no other user can have set up, and then renamed, so that readers never see
+  // a partial file.
+
+  void save_shared_magics() {
+
+#if !defined(_WIN32)
+    std::string dir = shared_magics_dir();
+    if (dir.empty())
+        return;
+
+    std::string data;
+    auto append = [&](const void* p, size_t n) { data.append(static_cast<const char*>(p), n); };
+
+    SharedMagicsHeader header = { SharedMagicsSignature, SharedMagicsFlags };
+    append(&header, sizeof(header));
+
+    for (Magic* magics : { RookMagics, BishopMagics })
+        for (Square s = SQ_A1; s <= SQ_H8; ++s)
+        {
+            size_t offset = magics == RookMagics ? size_t(magics[s].attacks - RookTable)
+                                                 : size_t(magics[s].attacks - BishopTable) + std::size(RookTable);
+            SharedMagic sm = { magics[s].mask, magics[s].magic, offset, magics[s].shift };
+            append(&sm, sizeof(sm));
+        }
+
+    append(RookTable, sizeof(RookTable));
+    append(BishopTable, sizeof(BishopTable));
+
+    std::string tmp = dir + "/hypnos-magics-XXXXXX";
+    int fd = mkstemp(tmp.data());
+    if (fd < 0)
+        return;
+
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n <= 0)
+            break;
+        done += size_t(n);
+    }
+
+    if (close(fd) != 0 || done != data.size() || rename(tmp.c_str(), shared_magics_path(dir).c_str()))
+        unlink(tmp.c_str());
+#endif
+  }
 }
 
 } // namespace Hypnos
@@ -34,7 +34,7 @@ bool probe(Square wksq, Square wpsq, Square bksq, Color us);
 
 namespace Bitboards {
 
-void init();
+void init(bool shareTables = false);
 std::string pretty(Bitboard b);
 
 } // namespace Hypnos::Bitboards
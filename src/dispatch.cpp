@@ -0,0 +1,135 @@
+/*
+  HypnoS, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2025 The Stockfish developers (see AUTHORS file)
+
+  HypnoS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  HypnoS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// The dispatcher is the entry point of a fat build ('make fat'). The engine is
+/// compiled once per x86-64 ISA level, and this small program, built for the
+/// baseline ISA, picks the best engine the CPU can run with cpuid and replaces
+/// itself with it. The selected build is passed on in HYPNOS_DISPATCH, which
+/// the engine reports in its banner and with the 'compiler' command.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+  struct Build {
+    const char* arch;
+    bool (*supported)();
+  };
+
+  // Pext is microcoded, and so much slower than the magic multiply, on AMD
+  // processors before Zen 3 (family 19h).
+  bool fast_pext() {
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (!__builtin_cpu_is("amd"))
+        return true;
+
+    unsigned eax, ebx, ecx, edx;
+    __asm__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+
+    unsigned family = (eax >> 8) & 0xF;
+    if (family == 0xF)
+        family += (eax >> 20) & 0xFF;
+
+    return family >= 0x19;
+#else
+    return true;
+#endif
+  }
+
+  // From the best to the baseline, the same order as 'make help'
+  const Build Builds[] = {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    { "x86-64-avx512",       [] { return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2") && fast_pext(); } },
+    { "x86-64-bmi2",         [] { return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") && fast_pext(); } },
+    { "x86-64-avx2",         [] { return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"); } },
+    { "x86-64-sse41-popcnt", [] { return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt"); } },
+#endif
+    { "x86-64",              [] { return true; } }
+  };
+
+  bool exists(const std::string& path) {
+
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+
+    std::fclose(f);
+    return true;
+  }
+
+  // Directory of the dispatcher, where the engine builds are installed
+  std::string own_dir(const char* argv0) {
+
+    std::string path = argv0;
+
+#if !defined(_WIN32)
+    char buf[4096];
+    ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+    if (len > 0)
+        path.assign(buf, size_t(len));
+#endif
+
+    size_t pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? std::string() : path.substr(0, pos + 1);
+  }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+
+  const std::string dir = own_dir(argv[0]);
+
+#if defined(_WIN32)
+  const std::string ext = ".exe";
+#else
+  const std::string ext = "";
+#endif
+
+  for (const Build& b : Builds)
+  {
+      std::string exe = dir + "hypnos-" + b.arch + ext;
+
+      if (!b.supported() || !exists(exe))
+          continue;
+
+      std::string dispatched = std::string(b.arch) + " (selected at startup via cpuid)";
+
+#if defined(_WIN32)
+      _putenv_s("HYPNOS_DISPATCH", dispatched.c_str());
+      std::fflush(stdout);
+      return int(_spawnv(_P_WAIT, exe.c_str(), argv));
+#else
+      setenv("HYPNOS_DISPATCH", dispatched.c_str(), 1);
+      execv(exe.c_str(), argv);
+      std::perror(exe.c_str());
+#endif
+  }
+
+  std::fprintf(stderr, "No engine build found for this CPU next to the dispatcher\n");
+  return EXIT_FAILURE;
+}
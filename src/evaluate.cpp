@@ -28,6 +28,13 @@
 #include <vector>
 #include "nlohmann/json.hpp"
 
+#if defined(EVAL_PROFILE) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <x86intrin.h>
+#define PROFILE_TICKS "cycles"
+#else
+#define PROFILE_TICKS "ns"
+#endif
+
 #include "bitboard.h"
 #include "evaluate.h"
 #include "material.h"
@@ -64,7 +71,7 @@ int loss_streak = 0;  // Definition of the global variable
 
 namespace Trace {
 
-  enum Tracing { NO_TRACE, TRACE };
+  enum Tracing { NO_TRACE, TRACE, PROFILE };
 
   enum Term { // The first 8 entries are reserved for PieceType
     MATERIAL = 8, IMBALANCE, MOBILITY, THREAT, PASSED, SPACE, WINNABLE, TOTAL, TERM_NB
@@ -195,6 +202,16 @@ namespace {
   constexpr Score WeakQueenProtection = S( 14,  0);
   constexpr Score WeakQueen           = S( 57, 19);
 
+  // Clock of the evaluation profile, the time stamp counter where available
+  inline uint64_t profile_ticks() {
+#if defined(EVAL_PROFILE) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
 
 #undef S
 
@@ -434,7 +451,7 @@ namespace {
                 score -= WeakQueen;
         }
     }
-    if constexpr (T)
+    if constexpr (T == TRACE)
         Trace::add(Pt, Us, score);
 
     return score;
@@ -534,7 +551,7 @@ namespace {
     // Penalty if king flank is under attack, potentially moving toward the king
     score -= FlankAttacks * kingFlankAttack;
 
-    if constexpr (T)
+    if constexpr (T == TRACE)
         Trace::add(KING, Us, score);
 
     return score;
@@ -635,7 +652,7 @@ namespace {
         score += SliderOnQueen * popcount(b & safe & attackedBy2[Us]) * (1 + queenImbalance);
     }
 
-    if constexpr (T)
+    if constexpr (T == TRACE)
         Trace::add(THREAT, Us, score);
 
     return score;
@@ -728,7 +745,7 @@ namespace {
         score += bonus - PassedFile * edge_distance(file_of(s));
     }
 
-    if constexpr (T)
+    if constexpr (T == TRACE)
         Trace::add(PASSED, Us, score);
 
     return score;
@@ -769,7 +786,7 @@ namespace {
     int weight = pos.count<ALL_PIECES>(Us) - 3 + std::min(pe->blocked_count(), 9);
     Score score = make_score(bonus * weight * weight / 16, 0);
 
-    if constexpr (T)
+    if constexpr (T == TRACE)
         Trace::add(SPACE, Us, score);
 
     return score;
@@ -864,7 +881,7 @@ namespace {
        + eg * int(PHASE_MIDGAME - me->game_phase()) * ScaleFactor(sf) / SCALE_FACTOR_NORMAL;
     v /= PHASE_MIDGAME;
 
-    if constexpr (T)
+    if constexpr (T == TRACE)
     {
         Trace::add(WINNABLE, make_score(u, eg * ScaleFactor(sf) / SCALE_FACTOR_NORMAL - eg_value(score)));
         Trace::add(TOTAL, make_score(mg, eg * ScaleFactor(sf) / SCALE_FACTOR_NORMAL));
@@ -887,13 +904,48 @@ namespace {
         return make_score(mg_value(s) * factor, eg_value(s) * factor);
     };
 
+#ifdef EVAL_PROFILE
+    Eval::Profile& prof = pos.this_thread()->evalProfile;
+#endif
+    uint64_t ticks = 0;
+
+    // Charges the ticks since the previous stage to the given one
+    auto profile = [&]([[maybe_unused]] ProfileStage s) {
+#ifdef EVAL_PROFILE
+        if constexpr (T == PROFILE)
+        {
+            uint64_t t = profile_ticks();
+            prof.count[s]++;
+            prof.ticks[s] += t - ticks;
+            ticks = t;
+        }
+#endif
+    };
+
+    // Counts an evaluation outcome, see Eval::Profile
+    auto count = [&]([[maybe_unused]] uint64_t Eval::Profile::*field) {
+#ifdef EVAL_PROFILE
+        if constexpr (T == PROFILE)
+            prof.*field += 1;
+#endif
+    };
+
+    if constexpr (T == PROFILE)
+        ticks = profile_ticks();
+
+    count(&Eval::Profile::calls);
+
     // Probe the material hash table
     me = Material::probe(pos);
+    profile(PROF_MATERIAL);
 
     // If we have a specialized evaluation function for the current material
     // configuration, call it and return.
     if (me->specialized_eval_exists())
+    {
+        count(&Eval::Profile::specialized);
         return me->evaluate(pos);
+    }
 
     // Initialize score by reading the incrementally updated scores included in
     // the position object (material + piece square tables) and the material
@@ -903,6 +955,7 @@ namespace {
     // Probe the pawn hash table
     pe = Pawns::probe(pos);
     score += pe->pawn_score(WHITE) - pe->pawn_score(BLACK);
+    profile(PROF_PAWNS);
 
     // 3. Function **lazy_skip** to skip detailed evaluations if the score is already high enough
     auto lazy_skip = [&](Value lazyThreshold) {
@@ -912,7 +965,10 @@ namespace {
     };
 
     if (pos.game_ply() > 5 && lazy_skip(LazyThreshold1)) {
-        return winnable(score);
+        count(&Eval::Profile::lazy1);
+        Value v = winnable(score);
+        profile(PROF_WINNABLE);
+        return v;
     }
 
     // Reintegration of personality parameters with default values
@@ -942,7 +998,9 @@ namespace {
     int loss_streak        = Hypnos::Eval::activePersonality.get_evaluation_param("LossStreak", 0);    
 
     // Application of personality parameters only if lazy_skip has not skipped the evaluation.
-    if (!lazy_skip(LazyThreshold2)) {
+    if (lazy_skip(LazyThreshold2))
+        count(&Eval::Profile::lazy2Personality);
+    else {
 
     // Declaration of all dynamic variables at the beginning
     int dynamicAggressiveness = aggressiveness;
@@ -1122,9 +1180,11 @@ namespace {
     Score pawnPushes = make_score(pos.count<PAWN>(WHITE), pos.count<PAWN>(BLACK));
     score += scale_by(pawnPushes, dynamicPawnPush / 40);  // Second halving
     }
+    profile(PROF_PERSONALITY);
 
 initialize<WHITE>();
 initialize<BLACK>();
+profile(PROF_INITIALIZE);
 
 
 // Pieces evaluated first (also populates attackedBy, attackedBy2).
@@ -1134,23 +1194,34 @@ score += pieces<WHITE, KNIGHT>() - pieces<BLACK, KNIGHT>()
        + pieces<WHITE, QUEEN>()  - pieces<BLACK, QUEEN>();
 
 score += mobility[WHITE] - mobility[BLACK];
+profile(PROF_PIECES);
 
 // More complex interactions that require fully populated attack bitboards
-score += king<WHITE>() - king<BLACK>()
-       + passed<WHITE>() - passed<BLACK>();
+score += king<WHITE>() - king<BLACK>();
+profile(PROF_KING);
+
+score += passed<WHITE>() - passed<BLACK>();
+profile(PROF_PASSED);
 
 if (lazy_skip(LazyThreshold2)) {
-    return winnable(score);
+    count(&Eval::Profile::lazy2Threats);
+    Value v = winnable(score);
+    profile(PROF_WINNABLE);
+    return v;
 }
 
-score += threats<WHITE>() - threats<BLACK>()
-       + space<WHITE>() - space<BLACK>()
+score += threats<WHITE>() - threats<BLACK>();
+profile(PROF_THREATS);
+
+score += space<WHITE>() - space<BLACK>()
        + (pe->pawn_score(WHITE) - pe->pawn_score(BLACK));
+profile(PROF_SPACE);
 
 // Derive single value from mg and eg parts of score
 Value v = winnable(score);
+profile(PROF_WINNABLE);
 
-if constexpr (T) {
+if constexpr (T == TRACE) {
     Trace::add(MATERIAL, pos.psq_score());
     Trace::add(IMBALANCE, me->imbalance());
     Trace::add(PAWN, pe->pawn_score(WHITE), pe->pawn_score(BLACK));
@@ -1194,7 +1265,11 @@ Value evaluate(const Position& pos) {
     int complexity = 0; // Default complexity
 
     // Calculate the initial evaluation
+#ifdef EVAL_PROFILE
+    Value v = Evaluation<PROFILE>(pos).value();
+#else
     Value v = Evaluation<NO_TRACE>(pos).value();
+#endif
 
     // Blend optimism with complexity and PSQ evaluation
     optimism += optimism * (complexity + abs(psq - v)) / 512;
@@ -1265,6 +1340,75 @@ ss << "Final evaluation       " << to_cp(v) << " (white side)\n";
 return ss.str();
 }
 
+
+/// profile_clear() resets the evaluation profile of all the threads
+
+void profile_clear() {
+
+#ifdef EVAL_PROFILE
+  for (Thread* th : Threads)
+      th->evalProfile = {};
+#endif
+}
+
+
+/// profile_print() prints the evaluation profile summed over all the threads:
+/// how often the evaluation exits early, then for each stage how many
+/// evaluations reach it and the clock ticks it takes, on average and in total.
+
+void profile_print(std::ostream& os) {
+
+#ifdef EVAL_PROFILE
+  constexpr const char* Names[PROF_STAGE_NB] = {
+    "material", "pawns", "personality", "initialize", "pieces",
+    "king", "passed", "threats", "space", "winnable"
+  };
+
+  Profile sum = {};
+  for (Thread* th : Threads)
+  {
+      const Profile& p = th->evalProfile;
+      sum.calls            += p.calls;
+      sum.specialized      += p.specialized;
+      sum.lazy1            += p.lazy1;
+      sum.lazy2Personality += p.lazy2Personality;
+      sum.lazy2Threats     += p.lazy2Threats;
+
+      for (int s = 0; s < PROF_STAGE_NB; ++s)
+          sum.count[s] += p.count[s], sum.ticks[s] += p.ticks[s];
+  }
+
+  uint64_t total = 0;
+  for (int s = 0; s < PROF_STAGE_NB; ++s)
+      total += sum.ticks[s];
+
+  auto pct = [](uint64_t n, uint64_t d) { return d ? 100.0 * n / d : 0.0; };
+
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(1)
+     << "Eval profile    : " << sum.calls << " evaluations, personality " << activePersonality.name
+     << "\n  specialized   " << std::setw(12) << sum.specialized      << std::setw(8) << pct(sum.specialized, sum.calls) << "%"
+     << "\n  lazy skip 1   " << std::setw(12) << sum.lazy1            << std::setw(8) << pct(sum.lazy1, sum.calls) << "%"
+     << "\n  lazy skip 2a  " << std::setw(12) << sum.lazy2Personality << std::setw(8) << pct(sum.lazy2Personality, sum.calls) << "%  (personality terms)"
+     << "\n  lazy skip 2b  " << std::setw(12) << sum.lazy2Threats     << std::setw(8) << pct(sum.lazy2Threats, sum.calls) << "%  (threats and space)"
+     << "\n\n  " << std::left << std::setw(12) << "stage" << std::right
+     << std::setw(12) << "runs" << std::setw(8) << "calls"
+     << std::setw(12) << PROFILE_TICKS "/run" << std::setw(16) << "total" << std::setw(8) << "share";
+
+  for (int s = 0; s < PROF_STAGE_NB; ++s)
+      ss << "\n  " << std::left << std::setw(12) << Names[s] << std::right
+         << std::setw(12) << sum.count[s]
+         << std::setw(7)  << pct(sum.count[s], sum.calls) << "%"
+         << std::setw(12) << (sum.count[s] ? double(sum.ticks[s]) / sum.count[s] : 0.0)
+         << std::setw(16) << sum.ticks[s]
+         << std::setw(7)  << pct(sum.ticks[s], total) << "%";
+
+  os << ss.str();
+#else
+  os << "Eval profile    : not compiled in, build with 'make build evalprofile=yes'";
+#endif
+}
+
 } // namespace Eval
 
 } // namespace Hypnos
\ No newline at end of file
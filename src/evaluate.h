@@ -19,6 +19,8 @@
 #ifndef EVALUATE_H_INCLUDED
 #define EVALUATE_H_INCLUDED
 
+#include <cstdint>
+#include <iosfwd>
 #include <string>
 #include "types.h"
 #include "personalities/personality.h"
@@ -42,6 +44,22 @@ namespace Eval {
 
   extern int loss_streak;  // Make loss_streak accessible
 
+  /// Evaluation profile, filled by each thread when the engine is built with
+  /// 'make build evalprofile=yes' (EVAL_PROFILE). It counts the evaluations,
+  /// the early exits and the clock ticks spent in each stage of the evaluation.
+  enum ProfileStage {
+    PROF_MATERIAL, PROF_PAWNS, PROF_PERSONALITY, PROF_INITIALIZE, PROF_PIECES,
+    PROF_KING, PROF_PASSED, PROF_THREATS, PROF_SPACE, PROF_WINNABLE, PROF_STAGE_NB
+  };
+
+  struct Profile {
+    uint64_t calls, specialized, lazy1, lazy2Personality, lazy2Threats;
+    uint64_t count[PROF_STAGE_NB], ticks[PROF_STAGE_NB];
+  };
+
+  void profile_clear();
+  void profile_print(std::ostream& os);
+
 } // namespace Eval
 
 } // namespace Hypnos
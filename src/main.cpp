@@ -16,6 +16,7 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
 #include <iostream>
 #include<stdio.h>
 #include <fstream>
@@ -43,7 +44,36 @@ Personality activePersonality;
 
 int main(int argc, char* argv[]) {
 
+    // Leading flags: --low-memory selects the low memory profile, and
+    // --startup-profile prints the time taken by each initialization step.
+    bool lowMemory = false, startupProfile = false;
+
+    for ( ; argc > 1 && std::string(argv[1]).rfind("--", 0) == 0; --argc, ++argv)
+        if (std::string(argv[1]) == "--low-memory")
+            lowMemory = true;
+        else if (std::string(argv[1]) == "--startup-profile")
+            startupProfile = true;
+        else
+            break;
+
+    // All the output goes through the output thread from now on
+    start_async_output();
+
+    auto start = std::chrono::steady_clock::now(), last = start;
+    auto profile = [&](const char* step) {
+        if (!startupProfile)
+            return;
+
+        auto t = std::chrono::steady_clock::now();
+        auto us = [](auto d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+        std::cerr << "info string startup " << step << " " << us(t - last)
+                  << " us, total " << us(t - start) << " us" << std::endl;
+        last = t;
+    };
+
     SysInfo::init();
+    profile("sysinfo");
+
     show_logo();
 
     std::cout << engine_info() << std::endl;
@@ -61,10 +91,17 @@ int main(int argc, char* argv[]) {
         << "L1/L2/L3 cache size   : " << SysInfo::cache_info(0) << "/" << SysInfo::cache_info(1)
         << "/" << SysInfo::cache_info(2) << std::endl
         << "Memory installed (RAM): " << SysInfo::total_memory() << std::endl << std::endl;
+    profile("banner");
 
     // Initialization of options
     UCI::init(Options);
 
+    // The low memory profile must be selected before any table is allocated
+    if (lowMemory)
+        Options["Low Memory"] = std::string("true");
+
+    profile("options");
+
     // Determine the personality file from the UCI option or use the default file
     std::string personalityDir = "perGM"; // Personality directory
     std::string personalityFile = (std::string)Options["Load Personality"] == "<empty>"
@@ -81,16 +118,20 @@ int main(int argc, char* argv[]) {
         std::cerr << "Info: Personality loaded successfully from: " << personalityFile << std::endl;
         activePersonality.print_summary(); // Print a summary of the loaded personality
     }
+    profile("personality");
 
     // Engine initializations
     Tune::init();
     PSQT::init();
-    Bitboards::init();
+    profile("psqt");
+    Bitboards::init(Options["Low Memory"]);
+    profile("bitboards");
     Position::init();
-    Bitbases::init();
+    profile("position");
     Endgames::init();
-    Threads.set(size_t(Options["Threads"]));
-    Search::clear(); 
+    profile("endgames");
+    Threads.set(size_t(Options["Threads"])); // Also sizes the hash, search tables are cleared at first use
+    profile("threads");
 
     // Start the UCI loop
     UCI::loop(argc, argv);
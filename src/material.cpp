@@ -126,10 +126,12 @@ namespace Material {
 Entry* probe(const Position& pos) {
 
   Key key = pos.material_key();
-  Entry* e = pos.this_thread()->materialTable[key];
+  Material::Table& table = pos.this_thread()->materialTable;
+  Entry* e = table[key];
 
+  ++table.probes;
   if (e->key == key)
-      return e;
+      return ++table.hits, e;
 
   std::memset(e, 0, sizeof(Entry));
   e->key = key;
@@ -46,14 +46,18 @@ using fun8_t = bool(*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGES
 }
 #endif
 
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <cstdlib>
 #include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string_view>
+#include <thread>
 #include <vector>
 #include <stdarg.h>
 #include <bitset>
@@ -73,6 +77,14 @@ using fun8_t = bool(*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGES
 #if defined(__linux__) && !defined(__ANDROID__)
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+#if defined(__linux__)
+#include <unistd.h>
 #endif
 
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32)) || defined(__e2k__)
@@ -94,42 +106,242 @@ namespace {
 static const string Version = " ";
 
 bool LPMessage = false;
+bool LargePagesAllowed = true;
+
+/// Output is asynchronous. std::cout and std::cerr write into a buffer of the
+/// calling thread, and each flush (std::endl, sync_endl) moves the buffered
+/// text as one record onto a lock-free queue. A dedicated thread drains the
+/// queue in batches to the real streams and to the debug log, so a thread
+/// never waits on a slow terminal, a full pipe or a log file. std::cerr loses
+/// its unitbuf flag meanwhile, so that it is flushed per line like std::cout,
+/// and the lines of different threads never interleave.
+
+enum Target { OUT, ERR, LOG }; // LOG records go to the debug log only
+
+class AsyncOutput {
+
+  struct Record {
+    Record* next;
+    Target target;
+    string text;
+  };
+
+  // Stream buffer of std::cout or std::cerr
+  struct Buf : public streambuf {
+
+    Buf(AsyncOutput& o, Target t) : output(o), target(t) {}
+
+    int overflow(int c) override {
+      if (c != EOF)
+          pending().push_back(char(c));
+      return traits_type::not_eof(c);
+    }
+
+    streamsize xsputn(const char* s, streamsize n) override {
+      pending().append(s, size_t(n));
+      return n;
+    }
+
+    int sync() override { output.push(target, pending()); return 0; }
+
+    string& pending() { thread_local string text[2]; return text[target]; }
+
+    AsyncOutput& output;
+    Target target;
+  };
+
+public:
+  AsyncOutput() : outBuf(*this, OUT), errBuf(*this, ERR) {
+    out = cout.rdbuf(&outBuf);
+    err = cerr.rdbuf(&errBuf);
+    cerr.unsetf(ios::unitbuf);
+    thread = std::thread(&AsyncOutput::idle_loop, this);
+  }
+
+ ~AsyncOutput() {
+    push(OUT, outBuf.pending());
+    push(ERR, errBuf.pending());
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        quit = true;
+    }
+    cv.notify_one();
+    thread.join();
+    cout.rdbuf(out);
+    cerr.rdbuf(err);
+    cerr.setf(ios::unitbuf);
+  }
+
+  // Queues the text for the I/O thread and leaves it empty. Only the swap of
+  // the queue head is shared, and the mutex is taken only to wake the thread.
+  void push(Target target, string& text) {
+
+    if (text.empty())
+        return;
+
+    Record* r = new Record{ head.load(std::memory_order_relaxed), target, std::move(text) };
+    text.clear();
+    pushed++;
+
+    while (!head.compare_exchange_weak(r->next, r))
+    {}
+
+    if (sleeping)
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        cv.notify_one();
+    }
+  }
+
+  // Waits until everything queued so far is written
+  void wait() {
+
+    std::unique_lock<std::mutex> lk(mutex);
+    drained.wait(lk, [&]{ return written == pushed; });
+  }
+
+  void set_log(streambuf* l) {
+
+    std::unique_lock<std::mutex> lk(mutex);
+    drained.wait(lk, [&]{ return written == pushed; });
+    log = l;
+  }
+
+private:
+  void idle_loop() {
+
+    while (true)
+    {
+        Record* r = head.exchange(nullptr);
+
+        if (!r)
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+            sleeping = true;
+            cv.wait(lk, [&]{ return quit || head.load(); });
+            sleeping = false;
+
+            if (quit && !head.load())
+                return;
+            continue;
+        }
+
+        // The queue is a stack, reverse it to the order of the pushes
+        Record* list = nullptr;
+        while (r)
+        {
+            Record* next = r->next;
+            r->next = list, list = r, r = next;
+        }
+
+        std::lock_guard<std::mutex> lk(mutex);
+        write(list);
+        drained.notify_all();
+    }
+  }
+
+  // Writes a batch with one call per run of records of the same stream, and
+  // prefixes the lines of the debug log with "<< " or ">> " like before.
+  void write(Record* list) {
+
+    string outText, logText;
+    uint64_t n = 0;
+
+    for (Record* r = list; r; ++n)
+    {
+        if (r->target == ERR)
+        {
+            out->sputn(outText.data(), streamsize(outText.size()));
+            outText.clear();
+            err->sputn(r->text.data(), streamsize(r->text.size()));
+        }
+        else
+        {
+            if (r->target == OUT)
+                outText += r->text;
+
+            if (log)
+                for (char c : r->text)
+                {
+                    if (lastLog == '\n')
+                        logText += r->target == OUT ? "<< " : ">> ";
+                    logText += lastLog = c;
+                }
+        }
+
+        Record* next = r->next;
+        delete r;
+        r = next;
+    }
+
+    out->sputn(outText.data(), streamsize(outText.size()));
+    out->pubsync();
+    err->pubsync();
+
+    if (log && !logText.empty())
+    {
+        log->sputn(logText.data(), streamsize(logText.size()));
+        log->pubsync();
+    }
+
+    written += n;
+  }
+
+  Buf outBuf, errBuf;
+  streambuf *out, *err, *log = nullptr;
+  char lastLog = '\n';
+  std::atomic<Record*> head = nullptr;
+  std::atomic<uint64_t> pushed = 0;
+  uint64_t written = 0;
+  std::atomic_bool sleeping = false;
+  bool quit = false;
+  std::mutex mutex;
+  std::condition_variable cv, drained;
+  std::thread thread;
+};
+
+AsyncOutput& output() {
+  static AsyncOutput o;
+  return o;
+}
 
-/// Our fancy logging facility. The trick here is to replace cin.rdbuf() and
-/// cout.rdbuf() with two Tie objects that tie cin and cout to a file stream. We
-/// can toggle the logging of std::cout and std:cin at runtime whilst preserving
-/// usual I/O functionality, all without changing a single line of code!
-/// Idea from http://groups.google.com/group/comp.lang.c++/msg/1d941c0f26ea0d81
+
+/// Our fancy logging facility. The output side is the debug log of AsyncOutput,
+/// and the input side replaces cin.rdbuf() with a Tie object that passes each
+/// line read on to the same queue, so that the log keeps the order of the
+/// dialogue. Logging can be toggled at runtime without changing a single line
+/// of code! Idea from http://groups.google.com/group/comp.lang.c++/msg/1d941c0f26ea0d81
 
 struct Tie: public streambuf { // MSVC requires split streambuf for cin and cout
 
-  Tie(streambuf* b, streambuf* l) : buf(b), logBuf(l) {}
+  Tie(streambuf* b) : buf(b) {}
 
-  int sync() override { return logBuf->pubsync(), buf->pubsync(); }
-  int overflow(int c) override { return log(buf->sputc((char)c), "<< "); }
+  int sync() override { return buf->pubsync(); }
   int underflow() override { return buf->sgetc(); }
-  int uflow() override { return log(buf->sbumpc(), ">> "); }
+  int uflow() override { return log(buf->sbumpc()); }
 
-  streambuf *buf, *logBuf;
+  streambuf* buf;
+  string line;
 
-  int log(int c, const char* prefix) {
+  int log(int c) {
 
-    static int last = '\n'; // Single log file
+    if (c != EOF)
+        line += char(c);
 
-    if (last == '\n')
-        logBuf->sputn(prefix, 3);
+    if (c == '\n' || (c == EOF && !line.empty()))
+        output().push(LOG, line);
 
-    return last = logBuf->sputc((char)c);
+    return c;
   }
 };
 
 class Logger {
 
-  Logger() : in(cin.rdbuf(), file.rdbuf()), out(cout.rdbuf(), file.rdbuf()) {}
+  Logger() : in(cin.rdbuf()) { output(); } // The queue must outlive the logger
  ~Logger() { start(""); }
 
   ofstream file;
-  Tie in, out;
+  Tie in;
 
 public:
   static void start(const std::string& fname) {
@@ -138,8 +350,8 @@ public:
 
     if (l.file.is_open())
     {
-        cout.rdbuf(l.out.buf);
         cin.rdbuf(l.in.buf);
+        output().set_log(nullptr);
         l.file.close();
     }
 
@@ -153,8 +365,8 @@ public:
             exit(EXIT_FAILURE);
         }
 
+        output().set_log(l.file.rdbuf());
         cin.rdbuf(&l.in);
-        cout.rdbuf(&l.out);
     }
   }
 };
@@ -294,6 +506,10 @@ std::string compiler_info() {
     compiler += " DEBUG";
   #endif
 
+  // Set by the dispatcher of a fat build, see dispatch.cpp
+  if (const char* dispatched = std::getenv("HYPNOS_DISPATCH"))
+      compiler += std::string("\nDispatched build      : ") + dispatched;
+
   compiler += "\n__VERSION__ macro expands to: ";
   #ifdef __VERSION__
      compiler += __VERSION__;
@@ -594,94 +810,67 @@ namespace SysInfo
 
             release_memory();
 #elif defined(__linux__)
-            const int max_buffer = 1024;
-            char buffer[max_buffer];
-
-            //Run 'lscpu' to get CPU information
-            FILE* stream = popen("lscpu 2>&1", "r");
-            if (!stream)
-                return;
+            // Read the topology straight from sysfs and procfs. Running 'lscpu'
+            // through popen() costs a fork and an exec on every engine start.
+            auto read_line = [](const string& path)
+            {
+                std::ifstream in(path);
+                string line;
+                std::getline(in, line);
+                return line;
+            };
 
-            string cpuData;
-            while (!feof(stream))
+            // Number of CPUs in a list like "0-3,8-11"
+            auto list_size = [](const string& list)
             {
-                if (fgets(buffer, max_buffer, stream) != NULL)
-                    cpuData.append(buffer);
-            }
+                uint32_t n = 0;
+                std::istringstream ss(list);
+                string range;
+                while (std::getline(ss, range, ','))
+                {
+                    size_t dash = range.find('-');
+                    n += dash == string::npos ? 1 : atoi(range.c_str() + dash + 1) - atoi(range.c_str()) + 1;
+                }
+                return n;
+            };
 
-            pclose(stream);
+            const string cpu0 = "/sys/devices/system/cpu/cpu0/";
 
-            if (cpuData.empty())
-                return;
+            processorCoreCount = list_size(read_line("/sys/devices/system/cpu/possible"));
 
-            auto parse_unit = [](const char *s)
-            {
-                if (strcasecmp(s, "KB") == 0 || strcasecmp(s, "KiB") == 0)
-                    return 1024;
+            uint32_t threadsPerCore = list_size(read_line(cpu0 + "topology/thread_siblings_list"));
 
-                if (strcasecmp(s, "MB") == 0 || strcasecmp(s, "MiB") == 0)
-                    return 1024 * 1024;
+            if (processorCoreCount)
+                logicalProcessorCount = processorCoreCount * std::max(threadsPerCore, 1u);
 
-                if (strcasecmp(s, "GB") == 0 || strcasecmp(s, "GiB") == 0)
-                    return 1024 * 1024 * 1024;
+            numaNodeCount = list_size(read_line("/sys/devices/system/node/online"));
 
-                return 0;
-            };
+            // Cache sizes of the first core, given as "48K"
+            for (int i = 0; ; ++i)
+            {
+                const string index = cpu0 + "cache/index" + to_string(i) + "/";
+                string level = read_line(index + "level"), size = read_line(index + "size");
 
-            //Find required data
-            static regex rgxNumberOfCpus("^CPU\\(s\\):\\s*(\\d*)$");
-            static regex rgxThreadsPerCode("^Thread\\(s\\) per core:\\s*(\\d*)$");
-            static regex rgxNumaNodes("NUMA node\\(s\\):\\s*(\\d*)$");
-            static regex rgxL1dCache("^L1d cache:\\s*(\\d*) (.*)$");
-            static regex rgxL1iCache("^L1i cache:\\s*(\\d*) (.*)$");
-            static regex rgxL2Cache("^L2 cache:\\s*(\\d*) (.*)$");
-            static regex rgxL3Cache("^L3 cache:\\s*(\\d*) (.*)$");
-            static regex rgxCpuBrand("^Model name:\\s*(.*)$");
+                if (level.empty() || size.empty())
+                    break;
 
-            int tempThreadsPerCode = 0;
+                int l = atoi(level.c_str());
+                uint32_t bytes = (uint32_t)atoi(size.c_str()) * (  size.back() == 'K' ? 1024
+                                                                 : size.back() == 'M' ? 1024 * 1024 : 1);
+                if (l >= 1 && l <= 3)
+                    processorCacheSize[l - 1] += bytes;
+            }
 
-            std::stringstream ss(cpuData);
-            std::string line;
-            while (std::getline(ss, line))
-            {
-                smatch match;
-                if (regex_search(line, match, rgxNumberOfCpus))
-                {
-                    processorCoreCount = (uint32_t)atoi(match[1].str().c_str());
-                }
-                else if(regex_search(line, match, rgxThreadsPerCode))
-                {
-                    tempThreadsPerCode = atoi(match[1].str().c_str());
-                }
-                else if (regex_search(line, match, rgxL1dCache) || regex_search(line, match, rgxL1iCache))
-                {
-                    processorCacheSize[0] += (uint32_t)atoi(match[1].str().c_str()) * parse_unit(match[2].str().c_str());
-                }
-                else if (regex_search(line, match, rgxL2Cache))
-                {
-                    processorCacheSize[1] += (uint32_t)atoi(match[1].str().c_str()) * parse_unit(match[2].str().c_str());
-                }
-                else if (regex_search(line, match, rgxL3Cache))
-                {
-                    processorCacheSize[2] += (uint32_t)atoi(match[1].str().c_str()) * parse_unit(match[2].str().c_str());
-                }
-                else if (regex_search(line, match, rgxNumaNodes))
+            std::ifstream cpuinfo("/proc/cpuinfo");
+            string line;
+            while (std::getline(cpuinfo, line))
+                if (line.rfind("model name", 0) == 0)
                 {
-                    numaNodeCount = (uint32_t)atoi(match[1].str().c_str());
-                }
-                else if (regex_search(line, match, rgxCpuBrand))
-                {
-                    cpuBrand = match[1].str();
+                    size_t colon = line.find(':');
+                    if (colon != string::npos && colon + 2 <= line.size())
+                        cpuBrand = line.substr(colon + 2);
+                    break;
                 }
-            }
-
-            if (processorCoreCount)
-            {
-                if (tempThreadsPerCode)
-                    logicalProcessorCount = processorCoreCount * tempThreadsPerCode;
-                else
-                    logicalProcessorCount = processorCoreCount;
-            }
 #endif
         }
 
@@ -975,6 +1164,38 @@ namespace SysInfo
 
         return format_bytes(totalMemory, 0);
     }
+
+    /// process_memory() returns the resident set size of the engine process,
+    /// split in anonymous memory and memory backed by (possibly shared) files.
+
+    const string process_memory()
+    {
+#if defined(__linux__)
+        std::ifstream status("/proc/self/status");
+        string line, rss = "N/A", anon = "N/A", file = "N/A";
+
+        while (std::getline(status, line))
+        {
+            std::istringstream ss(line);
+            string key;
+            uint64_t kb;
+
+            if (!(ss >> key >> kb))
+                continue;
+
+            if (key == "VmRSS:")
+                rss = format_bytes(kb * 1024, 1);
+            else if (key == "RssAnon:")
+                anon = format_bytes(kb * 1024, 1);
+            else if (key == "RssFile:")
+                file = format_bytes(kb * 1024, 1);
+        }
+
+        return rss + " (anonymous " + anon + ", file " + file + ")";
+#else
+        return "N/A";
+#endif
+    }
 }
 
 /// Debug functions used mainly to collect run-time statistics
@@ -1069,8 +1290,84 @@ void dbg_print() {
 }
 
 
-/// Used to serialize access to std::cout to avoid multiple threads writing at
-/// the same time.
+/// PerfCounters::open() starts the counters for the calling thread. It fails
+/// only if none of them can be opened, the dTLB event for instance is often
+/// missing in virtual machines.
+
+bool PerfCounters::open() {
+
+  close();
+
+#if defined(__linux__) && !defined(__ANDROID__)
+  const std::pair<uint32_t, uint64_t> events[EVENT_NB] = {
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) } };
+
+  for (int e = 0; e < EVENT_NB; ++e)
+  {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = events[e].first;
+      attr.config = events[e].second;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      fd[e] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+
+      if (fd[e] < 0 && err.empty())
+          err = std::strerror(errno) + std::string(errno == EACCES || errno == EPERM ?
+                ", see /proc/sys/kernel/perf_event_paranoid" : "");
+  }
+
+  for (int e = 0; e < EVENT_NB; ++e)
+      if (fd[e] >= 0)
+          return true;
+
+  return false;
+#else
+  err = "perf_event_open() is only available on Linux";
+  return false;
+#endif
+}
+
+void PerfCounters::close() {
+
+#if defined(__linux__)
+  for (int& f : fd)
+      if (f >= 0)
+          ::close(f), f = -1;
+#endif
+
+  err.clear();
+}
+
+/// PerfCounters::read() returns the count of an event so far, scaled up when
+/// the kernel had to multiplex the counters.
+
+uint64_t PerfCounters::read(Event e) const {
+
+#if defined(__linux__) && !defined(__ANDROID__)
+  uint64_t v[3]; // Value, time enabled, time running
+
+  if (fd[e] < 0 || ::read(fd[e], v, sizeof(v)) != sizeof(v) || !v[2])
+      return 0;
+
+  return v[1] == v[2] ? v[0] : uint64_t(double(v[0]) * v[1] / v[2]);
+#else
+  return 0;
+#endif
+}
+
+
+/// Used to serialize access to std::cout, whose format state is shared by all
+/// the threads. The lock is held while formatting only, the writes are done by
+/// the output thread.
 
 std::ostream& operator<<(std::ostream& os, SyncCout sc) {
 
@@ -1090,6 +1387,15 @@ std::ostream& operator<<(std::ostream& os, SyncCout sc) {
 void start_logger(const std::string& fname) { Logger::start(fname); }
 
 
+/// start_async_output() routes std::cout and std::cerr through the output
+/// thread until the end of the program.
+void start_async_output() { output(); }
+
+
+/// wait_for_output() returns once the output queued so far has been written
+void wait_for_output() { output().wait(); }
+
+
 /// prefetch() preloads the given address in L1/L2 cache. This is a non-blocking
 /// function that doesn't stall the CPU waiting for data to be loaded from memory,
 /// which can be quite slow.
@@ -1148,6 +1454,14 @@ void std_aligned_free(void* ptr) {
 #endif
 }
 
+/// allow_large_pages() lets aligned_large_pages_alloc() use large pages or not.
+/// Memory is released in the same way either way, so it can be toggled at any
+/// time; large pages are avoided when the footprint matters more than speed.
+
+void allow_large_pages(bool allow) {
+  LargePagesAllowed = allow;
+}
+
 /// aligned_large_pages_alloc() will return suitably aligned memory, if possible using large pages.
 
 #if defined(_WIN32)
@@ -1226,7 +1540,7 @@ static void* aligned_large_pages_alloc_windows([[maybe_unused]] size_t allocSize
 void* aligned_large_pages_alloc(size_t allocSize) {
 
   // Try to allocate large pages
-  void* mem = aligned_large_pages_alloc_windows(allocSize);
+  void* mem = LargePagesAllowed ? aligned_large_pages_alloc_windows(allocSize) : nullptr;
 
   // Fall back to regular, page aligned, allocation if necessary
   if (!mem)
@@ -1255,7 +1569,7 @@ void* aligned_large_pages_alloc(size_t allocSize) {
 void* aligned_large_pages_alloc(size_t allocSize) {
 
 #if defined(__linux__)
-  constexpr size_t alignment = 2 * 1024 * 1024; // assumed 2MB page size
+  const size_t alignment = LargePagesAllowed ? 2 * 1024 * 1024 : 4096; // assumed 2MB page size
 #else
   constexpr size_t alignment = 4096; // assumed small page size
 #endif
@@ -1264,7 +1578,8 @@ void* aligned_large_pages_alloc(size_t allocSize) {
   size_t size = ((allocSize + alignment - 1) / alignment) * alignment;
   void *mem = std_aligned_alloc(alignment, size);
 #if defined(MADV_HUGEPAGE)
-  madvise(mem, size, MADV_HUGEPAGE);
+  if (mem && LargePagesAllowed)
+      madvise(mem, size, MADV_HUGEPAGE);
 #endif
   return mem;
 }
@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstring>
 #include <functional>
 #include <mutex>
 #include <ostream>
@@ -56,10 +57,13 @@ std::string engine_info(bool to_uci = false);
 std::string compiler_info();
 void prefetch(void* addr);
 void start_logger(const std::string& fname);
+void start_async_output();
+void wait_for_output();
 void* std_aligned_alloc(size_t alignment, size_t size);
 void std_aligned_free(void* ptr);
 void* aligned_large_pages_alloc(size_t size); // memory aligned by page size, min alignment: 4096 bytes
 void aligned_large_pages_free(void* mem); // nop if mem == nullptr
+void allow_large_pages(bool allow);
 
 void dbg_hit_on(bool cond, int slot = 0);
 void dbg_mean_of(int64_t value, int slot = 0);
@@ -67,6 +71,31 @@ void dbg_stdev_of(int64_t value, int slot = 0);
 void dbg_correl_of(int64_t value1, int64_t value2, int slot = 0);
 void dbg_print();
 
+/// PerfCounters reads the hardware performance counters of one thread with
+/// perf_event_open() on Linux. The counters are opened by the thread to be
+/// measured, only count user space, and can then be read from any thread.
+/// Where perf is not available or restricted, open() fails and error() says why.
+
+class PerfCounters {
+
+  int fd[5] = { -1, -1, -1, -1, -1 };
+  std::string err;
+
+public:
+  enum Event { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, DTLB_MISSES, EVENT_NB };
+
+  PerfCounters() = default;
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+  ~PerfCounters() { close(); }
+
+  bool open();
+  void close();
+  bool available(Event e) const { return fd[e] >= 0; }
+  uint64_t read(Event e) const;
+  const std::string& error() const { return err; }
+};
+
 using TimePoint = std::chrono::milliseconds::rep; // A value in milliseconds
 static_assert(sizeof(TimePoint) == sizeof(int64_t), "TimePoint should be 64 bits");
 inline TimePoint now() {
@@ -74,12 +103,64 @@ inline TimePoint now() {
         (std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-template<class Entry, int Size>
-struct HashTable {
-  Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
+/// HashTable is a simple, always replace, hash table used for the per-thread
+/// pawn and material caches. Its size is set at runtime, in KB, and rounded
+/// down to a power of 2 number of entries. Tables of at least 2MB are placed
+/// in large pages. Probes and hits are counted by the users of the table.
+
+template<class Entry>
+class HashTable {
+
+  static constexpr size_t LargePageThreshold = 2 * 1024 * 1024;
+
+public:
+  HashTable() = default;
+  HashTable(const HashTable&) = delete;
+  HashTable& operator=(const HashTable&) = delete;
+ ~HashTable() { release(); }
+
+  Entry* operator[](Key key) { return &table[(uint32_t)key & mask]; }
+
+  void resize(size_t kbSize) {
+
+    size_t count = 1;
+    while (2 * count * sizeof(Entry) <= std::max(kbSize * 1024, sizeof(Entry)))
+        count *= 2;
+
+    if (table && count == mask + 1)
+        return;
+
+    release();
+    largePages = count * sizeof(Entry) >= LargePageThreshold;
+    table = static_cast<Entry*>(largePages ? aligned_large_pages_alloc(count * sizeof(Entry))
+                                           : std_aligned_alloc(64, count * sizeof(Entry)));
+    if (!table)
+    {
+        std::cerr << "Failed to allocate " << kbSize << "KB for a hash table." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::memset(static_cast<void*>(table), 0, count * sizeof(Entry));
+    mask = count - 1;
+    probes = hits = 0;
+  }
+
+  size_t size() const { return mask + 1; }
+
+  uint64_t probes = 0, hits = 0;
 
 private:
-  std::vector<Entry> table = std::vector<Entry>(Size); // Allocate on the heap
+  void release() {
+    if (largePages)
+        aligned_large_pages_free(table);
+    else
+        std_aligned_free(table);
+    table = nullptr;
+  }
+
+  Entry* table = nullptr;
+  size_t mask = 0;
+  bool largePages = false;
 };
 
 
@@ -203,6 +284,7 @@ namespace SysInfo
     const std::string is_hyper_threading();
     const std::string cache_info(int idx);
     const std::string total_memory();
+    const std::string process_memory();
 }
 } // namespace Stockfish
 
@@ -210,10 +210,12 @@ namespace Pawns {
 Entry* probe(const Position& pos) {
 
   Key key = pos.pawn_key();
-  Entry* e = pos.this_thread()->pawnsTable[key];
+  Pawns::Table& table = pos.this_thread()->pawnsTable;
+  Entry* e = table[key];
 
+  ++table.probes;
   if (e->key == key)
-      return e;
+      return ++table.hits, e;
 
   e->key = key;
   e->blockedCount = 0;
@@ -24,12 +24,21 @@
 #include "misc.h"
 #include <sys/timeb.h>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace std;
 using namespace Hypnos;
 
 PolyBook polybook[2];
 PRNG rng(time(NULL));
 
+void PolyBook::seed(uint64_t s) { rng = PRNG(s); }
+
 namespace
 {
     // Random numbers from PolyGlot, used to compute book hash keys
@@ -379,6 +388,7 @@ PolyBook::PolyBook()
 {
     keycount = 0;
     polyhash = NULL;
+    mappedSize = 0;
     enabled = false;
 
     index_first = index_best = index_rand = 0;
@@ -387,8 +397,32 @@ PolyBook::PolyBook()
 
 PolyBook::~PolyBook()
 {
-    if (polyhash != NULL)
-        delete[]polyhash;
+    release();
+}
+
+// The book is mapped read-only where possible, so that all the engine processes
+// using the same book file share a single copy of it in the page cache. Entries
+// are kept in the big-endian file layout and converted when they are read.
+
+void PolyBook::release()
+{
+#if !defined(_WIN32)
+    if (mappedSize)
+        munmap(polyhash, mappedSize);
+    else
+#endif
+        free(polyhash);
+
+    polyhash = NULL;
+    mappedSize = 0;
+    keycount = 0;
+}
+
+PolyHash PolyBook::entry(int idx) const
+{
+    PolyHash ph = polyhash[idx];
+    byteswap_polyhash(&ph);
+    return ph;
 }
 
 void PolyBook::init(const std::string& bookfile)
@@ -403,17 +437,43 @@ void PolyBook::init(const std::string& bookfile)
 
     sync_cout << "info string Loading Polyglot book: " << bookfile << sync_endl;
 
-    FILE *fpt = fopen(bookfile.c_str(), "rb");
-    if (fpt == NULL)
+    release();
+
+#if !defined(_WIN32)
+    int fd = open(bookfile.c_str(), O_RDONLY);
+    if (fd < 0)
     {
         sync_cout << "info string Could not open book file: " << bookfile << sync_endl;
         return;
     }
 
-    if (polyhash)
+    struct stat st;
+    size_t filesize = fstat(fd, &st) == 0 ? size_t(st.st_size) : 0;
+
+    if (filesize == 0 || filesize % sizeof(PolyHash) != 0)
     {
-        free(polyhash);
-        polyhash = NULL;
+        sync_cout << "info string Invalid Polyglot book file: size mismatch" << sync_endl;
+        close(fd);
+        return;
+    }
+
+    void* mem = mmap(NULL, filesize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mem == MAP_FAILED)
+    {
+        sync_cout << "info string Could not map book file: " << bookfile << sync_endl;
+        return;
+    }
+
+    polyhash = (PolyHash *)mem;
+    mappedSize = filesize;
+#else
+    FILE *fpt = fopen(bookfile.c_str(), "rb");
+    if (fpt == NULL)
+    {
+        sync_cout << "info string Could not open book file: " << bookfile << sync_endl;
+        return;
     }
 
     fseek(fpt, 0L, SEEK_END);
@@ -427,7 +487,6 @@ void PolyBook::init(const std::string& bookfile)
         return;
     }
 
-    keycount = filesize / sizeof(PolyHash);
     polyhash = (PolyHash *)malloc(filesize);
     if (!polyhash)
     {
@@ -441,15 +500,14 @@ void PolyBook::init(const std::string& bookfile)
 
     if (readSize != filesize)
     {
-        free(polyhash);
-        polyhash = NULL;
+        release();
 
         sync_cout << "info string Could not read entire book file: " << bookfile << sync_endl;
         return;
     }
+#endif
 
-    for (int i = 0; i < keycount; i++)
-        byteswap_polyhash(&polyhash[i]);
+    keycount = int(filesize / sizeof(PolyHash));
 
     sync_cout << "info string Book loaded successfully: " << bookfile 
               << " (" << keycount << " entries)" << sync_endl;
@@ -477,7 +535,7 @@ Move PolyBook::probe(Position& pos, int bookWidth) {
 
     // Select a random move from the chosen ones
     int idx = indices[rng.rand<uint32_t>() % indices.size()];
-    Move m = pg_move_to_sf_move(pos, polyhash[idx].move);
+    Move m = pg_move_to_sf_move(pos, entry(idx).move);
 
     // Check that the move does not lead to a stalemate
     if (!check_draw(pos, m))
@@ -563,11 +621,11 @@ int PolyBook::find_first_key(uint64_t key)
     {
         int mid = (end + start) / 2;
 
-        if (polyhash[mid].key < key)
+        if (entry(mid).key < key)
             start = mid;
         else
         {
-            if (polyhash[mid].key > key)
+            if (entry(mid).key > key)
                 end = mid;
             else
             {
@@ -582,10 +640,10 @@ int PolyBook::find_first_key(uint64_t key)
 
     for (int i = start; i < end; i++)
     {
-        if (key == polyhash[i].key)
+        if (key == entry(i).key)
         {
             index_first = i;
-            while ((index_first>0) && (key == polyhash[index_first - 1].key))
+            while ((index_first>0) && (key == entry(index_first - 1).key))
                 index_first--;
             return get_key_data();
         }
@@ -596,23 +654,23 @@ int PolyBook::find_first_key(uint64_t key)
 
 int PolyBook::get_key_data()
 {
-    int best_weight = polyhash[index_first].weight;
+    int best_weight = entry(index_first).weight;
     index_weight_count = best_weight;
-    uint64_t key = polyhash[index_first].key;
+    uint64_t key = entry(index_first).key;
 
     index_count = 1;
     index_best = index_first;
 
     for (int i = index_first + 1; i<keycount; i++)
     {
-        if (polyhash[i].key != key)
+        if (entry(i).key != key)
             break;
 
         index_count++;
-        index_weight_count += polyhash[i].weight;
-        if (polyhash[i].weight > best_weight)
+        index_weight_count += entry(i).weight;
+        if (entry(i).weight > best_weight)
         {
-            best_weight = polyhash[i].weight;
+            best_weight = entry(i).weight;
             index_best = i;
         }
     }
@@ -623,12 +681,12 @@ int PolyBook::get_key_data()
 
     for (int i = index_first; i < index_first + index_count; i++)
     {
-        if ((rand_pos >= weight_count) && (rand_pos < weight_count + polyhash[i].weight))
+        if ((rand_pos >= weight_count) && (rand_pos < weight_count + entry(i).weight))
         {
             index_rand = i;
             break;
         }
-        weight_count += polyhash[i].weight;
+        weight_count += entry(i).weight;
     }
 
     return index_count;
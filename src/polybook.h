@@ -40,6 +40,9 @@ public:
     void init(const std::string& bookfile);
     Hypnos::Move probe(Hypnos::Position& pos, int bookWidth);
 
+    // Seeds the random choice among book moves, shared by all the books
+    static void seed(uint64_t s);
+
 private:
 
     Hypnos::Key polyglot_key(const Hypnos::Position& pos);
@@ -50,8 +53,12 @@ private:
 
     bool check_draw(Hypnos::Position& pos, Hypnos::Move m);
 
+    void release();
+    PolyHash entry(int idx) const;
+
     int keycount;
     PolyHash *polyhash;
+    size_t mappedSize;
     bool enabled;
 
     int index_first;
@@ -59,8 +59,9 @@ struct StateInfo {
 
 /// start position to the position just before the search starts). Needed by
 /// 'draw by repetition' detection. Use a std::deque because pointers to
-/// elements are not invalidated upon list resizing.
-using StateListPtr = std::unique_ptr<std::deque<StateInfo>>;
+/// elements are not invalidated upon list resizing. The list is shared by the
+/// UCI loop, which may extend it with the next moves of the game, and the search.
+using StateListPtr = std::shared_ptr<std::deque<StateInfo>>;
 
 
 /// Position class stores information regarding the board representation as
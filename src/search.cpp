@@ -20,7 +20,9 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>   // For std::memset
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <algorithm> // For std::clamp
 
@@ -55,6 +57,13 @@ using std::string;
 using Eval::evaluate;
 using namespace Search;
 
+// Counts a search event of the current thread at the given depth
+#ifdef SEARCH_STATS
+#define STATS_INC(event, d) ++thisThread->searchStats[event][std::clamp(int(d), 0, STATS_DEPTH_NB - 1)]
+#else
+#define STATS_INC(event, d)
+#endif
+
 namespace {
 
   // Different node types, used as a template parameter
@@ -104,12 +113,54 @@ namespace {
     }
     bool enabled() const { return level < 20.0; }
     bool time_to_pick(Depth depth) const { return depth == 1 + int(level); }
+    uint64_t node_budget() const { return uint64_t(4096 * std::pow(1.7, level)); }
     Move pick_best(size_t multiPV);
 
     double level;
     Move best = MOVE_NONE;
   };
 
+  // ABDADA is an optional work sharing scheme on top of Lazy SMP. Threads flag
+  // the moves they are searching in a small lossy table, and at a node a thread
+  // defers the moves being searched by another one until all the other moves
+  // are done. By then the deferred results are often already in the TT.
+  constexpr Depth AbdadaDepth = 5;
+  constexpr int   MaxDeferred = 32;
+
+  bool Abdada;
+  std::atomic<Key> SearchingMoves[16384];
+
+  Key searching_key(Key posKey, Move m) { return posKey ^ make_key(m); }
+
+  std::atomic<Key>& searching_slot(Key k) {
+    return SearchingMoves[k & (std::size(SearchingMoves) - 1)];
+  }
+
+  bool searched_elsewhere(Key k) { return searching_slot(k).load(std::memory_order_relaxed) == k; }
+
+  void start_searching_move(Key k) { searching_slot(k).store(k, std::memory_order_relaxed); }
+
+  void finish_searching_move(Key k) {
+    Key expected = k;
+    searching_slot(k).compare_exchange_strong(expected, 0, std::memory_order_relaxed);
+  }
+
+  // kth_best_score() returns the k-th best score among the root moves that have
+  // one in the current iteration, or -VALUE_INFINITE if fewer than k have one.
+  Value kth_best_score(const RootMoves& rootMoves, size_t k) {
+
+    std::vector<Value> scores;
+    for (const RootMove& rm : rootMoves)
+        if (rm.score != -VALUE_INFINITE)
+            scores.push_back(rm.score);
+
+    if (scores.size() < k)
+        return -VALUE_INFINITE;
+
+    std::nth_element(scores.begin(), scores.begin() + k - 1, scores.end(), std::greater<Value>());
+    return scores[k - 1];
+  }
+
   template <NodeType nodeType>
   Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode);
 
@@ -126,30 +177,111 @@ namespace {
 
 // perft() is our utility to verify move generation. All the leaf nodes up
 // to the given depth are generated and counted, and the sum is returned.
-template<bool Root>
+// Subtree counts go to the optional perft hash, keyed by position and depth.
+// An entry stores its key xor-ed with its count, so that an entry torn by a
+// concurrent write is rejected like any other key mismatch.
+struct PerftEntry {
+  std::atomic<uint64_t> check, count;
+};
+
+std::unique_ptr<PerftEntry[]> PerftTable;
+size_t PerftEntries;
+
 uint64_t perft(Position& pos, Depth depth) {
 
-    StateInfo st;
+    if (depth == 1)
+        return MoveList<LEGAL>(pos).size();
 
-    uint64_t cnt, nodes = 0;
     const bool leaf = (depth == 2);
+    Key key = pos.key() ^ make_key(depth);
+    PerftEntry* e = PerftEntries && !leaf ? &PerftTable[key & (PerftEntries - 1)] : nullptr;
+
+    if (e)
+    {
+        uint64_t cnt = e->count.load(std::memory_order_relaxed);
+        if ((e->check.load(std::memory_order_relaxed) ^ cnt) == key)
+            return cnt;
+    }
+
+    StateInfo st;
+    uint64_t nodes = 0;
 
     for (const auto& m : MoveList<LEGAL>(pos))
     {
-        if (Root && depth <= 1)
-            cnt = 1, nodes++;
-        else
+        pos.do_move(m, st);
+        nodes += leaf ? MoveList<LEGAL>(pos).size() : perft(pos, depth - 1);
+        pos.undo_move(m);
+    }
+
+    if (e)
+    {
+        e->count.store(nodes, std::memory_order_relaxed);
+        e->check.store(key ^ nodes, std::memory_order_relaxed);
+    }
+    return nodes;
+}
+
+// perft_root() splits the root moves over the whole pool. Each thread takes
+// the next root move from a shared counter and counts its subtree from its
+// own copy of the root position. The counts are printed in move order.
+uint64_t perft_root(Depth depth) {
+
+    size_t entries = size_t(Options["Perft Hash"]) * 1024 * 1024 / sizeof(PerftEntry);
+    entries = entries ? size_t(1) << msb(entries) : 0;
+
+    if (entries != PerftEntries)
+    {
+        PerftTable.reset(entries ? new PerftEntry[entries]() : nullptr);
+        PerftEntries = entries;
+    }
+
+    MainThread* mainThread = Threads.main();
+    MoveList<LEGAL> moves(mainThread->rootPos);
+    std::vector<uint64_t> counts(moves.size());
+    std::atomic<size_t> next(0);
+
+    auto work = [&](Position& pos) {
+
+        StateInfo st;
+
+        for (size_t i; (i = next++) < moves.size(); )
+        {
+            Move m = *(moves.begin() + i);
+
+            if (depth <= 1)
+                counts[i] = 1;
+            else
+            {
+                pos.do_move(m, st);
+                counts[i] = perft(pos, depth - 1);
+                pos.undo_move(m);
+            }
+        }
+    };
+
+    for (Thread* th : Threads)
+        if (th != mainThread)
+            th->run_custom_job([&work, th]() { work(th->rootPos); });
+
+    work(mainThread->rootPos);
+
+    uint64_t nodes = 0;
+
+    for (Thread* th : Threads)
+        if (th != mainThread)
         {
-            pos.do_move(m, st);
-            cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - 1);
-            nodes += cnt;
-            pos.undo_move(m);
+            th->wait_for_search_finished();
+            th->nodes = 0; // Only the main thread reports the perft count
         }
-        if (Root)
-            sync_cout << UCI::move(m, pos.is_chess960()) << ": " << cnt << sync_endl;
+
+    for (size_t i = 0; i < moves.size(); ++i)
+    {
+        sync_cout << UCI::move(*(moves.begin() + i), mainThread->rootPos.is_chess960())
+                  << ": " << counts[i] << sync_endl;
+        nodes += counts[i];
     }
     return nodes;
-  }
+}
 
 } // namespace
 
@@ -182,13 +314,16 @@ void MainThread::search() {
 
   if (Limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft);
+      nodes = perft_root(Limits.perft);
       sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
       return;
   }
 
   Color us = rootPos.side_to_move();
   Time.init(Limits, us, rootPos.game_ply());
+
+  // A ponder search starts on the opponent's time, it is not timed for stats
+  bool ponderSearch = ponder;
   TT.new_search();
 
   Move bookMove = MOVE_NONE;
@@ -214,6 +349,18 @@ void MainThread::search() {
       }
       else
       {
+          Abdada = Options["ABDADA"] && Threads.size() > 1;
+
+          // A weakened engine picks its move at a fixed depth, so there is no
+          // point in letting the clock buy it more nodes than its level needs.
+          // The budget is per thread, as the nodes of all the threads count.
+          Skill skill(Options["Skill Level"], Options["Personality"] ? int(Options["Elo"]) : 0);
+          if (skill.enabled() && !Limits.nodes && (Limits.use_time_management() || Limits.movetime))
+          {
+              uint64_t budget = skill.node_budget() * Threads.size();
+              Time.nodeBudget = Time.nodeBudget ? std::min(Time.nodeBudget, budget) : budget;
+          }
+
           Threads.start_searching(); // start non-main threads
           Thread::search();          // main thread start searching
       }
@@ -222,14 +369,15 @@ void MainThread::search() {
   // When we reach the maximum depth, we can arrive here without a raise of
   // Threads.stop. However, if we are pondering or in an infinite search,
   // the UCI protocol states that we shouldn't print the best move before the
-  // GUI sends a "stop" or "ponderhit" command. We therefore simply wait here
-  // until the GUI sends one of those commands.
+  // GUI sends a "stop" or "ponderhit" command. We therefore wait here until
+  // the GUI sends one of those commands.
 
-  while (!Threads.stop && (ponder || Limits.infinite))
-  {} // Busy wait for a stop or a ponder reset
+  if (!Threads.stop && (ponder || Limits.infinite))
+      wait_for_stop_or_ponderhit();
 
   // Stop the threads if not already stopped (also raise the stop if
   // "ponderhit" just reset Threads.ponder).
+  TimePoint stopped = now();
   Threads.stop = true;
 
   // Wait until all threads have finished
@@ -304,14 +452,6 @@ void MainThread::search() {
 		Hypnos::UCI::personalityChanged = false;
 	}
 
-// Applying search depth to the evaluation with loss_streak bonus
-  int depthBonus = (Hypnos::Eval::loss_streak > 5) ? std::min(Hypnos::Eval::loss_streak / 2, 3) : 0;  // Max +3 ply
-  int totalDepth = calculationDepth + depthBonus;
-
-  if (totalDepth > 0) {
-      Limits.depth = std::clamp((Limits.depth > 0 ? Limits.depth : 1) + totalDepth, 1, MAX_PLY);
-  }
-
   static int lastElo = -1;  // Store the previous Elo value
 
   int currentElo = int(Options["Elo"]);
@@ -350,12 +490,18 @@ void MainThread::search() {
       }
   }
 
+  if (!ponderSearch)
+      Time.record_move();
+
   sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
 
   if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
       std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
 
   std::cout << sync_endl;
+
+  if (!ponderSearch)
+      Time.calibrate(Threads.nodes_searched(), stopped);
 }
 
 /// Thread::search() is the main iterative deepening loop. It calls search()
@@ -364,6 +510,9 @@ void MainThread::search() {
 
 void Thread::search() {
 
+  if (historyPending)
+      clear();
+
   // To allow access to (ss-7) up to (ss+2), the stack must be oversized.
   // The former is needed to allow update_continuation_histories(ss-1, ...),
   // which accesses its argument at ss-6, also near the root.
@@ -406,18 +555,30 @@ void Thread::search() {
   Skill skill(Options["Skill Level"], Options["Personality"] ? int(Options["Elo"]) : 0);
 
   // When playing with strength handicap enable MultiPV search that we will
-  // use behind-the-scenes to retrieve a set of possible moves.
+  // use behind-the-scenes to retrieve a set of possible moves. HumanImperfection
+  // needs an exact score for the second best move.
+  bool hiddenPV = skill.enabled() || int(Options["HumanImperfection"]) > 0;
   if (skill.enabled())
       multiPV = std::max(multiPV, (size_t)4);
+  else if (hiddenPV)
+      multiPV = std::max(multiPV, (size_t)2);
 
   multiPV = std::min(multiPV, rootMoves.size());
 
+  // In one pass mode all the PV lines come from a single root search with a
+  // k-th best window, instead of a full root search per line. Hidden lines
+  // are always searched this way, they only need candidate scores.
+  multiPVWidth = (Options["MultiPV One Pass"] || hiddenPV) && multiPV > 1 ? multiPV : 1;
+  size_t pvSearches = multiPV / multiPVWidth;
+
   int searchAgainCounter = 0;
 
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   ++rootDepth < MAX_PLY
          && !Threads.stop
-         && !(Limits.depth && mainThread && rootDepth > Limits.depth))
+         && !maxNodesHit
+         && !(Limits.depth && mainThread && rootDepth > Limits.depth)
+         && !(maxDepth && rootDepth > maxDepth))
   {
       // Age out PV variability metric
       if (mainThread)
@@ -435,7 +596,7 @@ void Thread::search() {
           searchAgainCounter++;
 
       // MultiPV loop. We perform a full root search for each PV line
-      for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+      for (pvIdx = 0; pvIdx < pvSearches && !Threads.stop && !maxNodesHit; ++pvIdx)
       {
           if (pvIdx == pvLast)
           {
@@ -450,8 +611,9 @@ void Thread::search() {
 
           // Reset aspiration window starting size
           Value prev = rootMoves[pvIdx].averageScore;
+          Value low = rootMoves[pvIdx + multiPVWidth - 1].averageScore;
           delta = Value(10) + int(prev) * prev / 15799;
-          alpha = std::max(prev - delta,-VALUE_INFINITE);
+          alpha = std::max(low - delta,-VALUE_INFINITE);
           beta  = std::min(prev + delta, VALUE_INFINITE);
 
           // Adjust optimism based on root move's previousScore
@@ -468,6 +630,11 @@ void Thread::search() {
               // Adjust the effective depth searched, but ensure at least one effective increment for every
               // four searchAgain steps (see issue #2717).
               Depth adjustedDepth = std::max(1, rootDepth - failedHighCnt - 3 * (searchAgainCounter + 1) / 4);
+
+              if (multiPVWidth > 1)
+                  for (RootMove& rm : rootMoves)
+                      rm.score = -VALUE_INFINITE;
+
               bestValue = Hypnos::search<Root>(rootPos, ss, alpha, beta, adjustedDepth, false);
 
               // Bring the best move to the front. It is critical that sorting
@@ -481,7 +648,7 @@ void Thread::search() {
               // If search has been stopped, we break immediately. Sorting is
               // safe because RootMoves is still valid, although it refers to
               // the previous iteration.
-              if (Threads.stop)
+              if (Threads.stop || maxNodesHit)
                   break;
 
               // When failing high/low give some update (without cluttering
@@ -493,11 +660,15 @@ void Thread::search() {
                   sync_cout << UCI::pv(rootPos, rootDepth) << sync_endl;
 
               // In case of failing low/high increase aspiration window and
-              // re-search, otherwise exit the loop.
-              if (bestValue <= alpha)
+              // re-search, otherwise exit the loop. In one pass MultiPV mode
+              // the window must hold the k-th best score too.
+              Value kthValue = multiPVWidth > 1 && bestValue < beta ? rootMoves[multiPVWidth - 1].score : bestValue;
+
+              if (kthValue <= alpha)
               {
-                  beta = (alpha + beta) / 2;
-                  alpha = std::max(bestValue - delta, -VALUE_INFINITE);
+                  if (bestValue <= alpha)
+                      beta = (alpha + beta) / 2;
+                  alpha = std::max(kthValue - delta, -VALUE_INFINITE);
 
                   failedHighCnt = 0;
                   if (mainThread)
@@ -520,11 +691,11 @@ void Thread::search() {
           std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
           if (    mainThread
-              && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
+              && (Threads.stop || pvIdx + 1 == pvSearches || Time.elapsed() > 3000))
               sync_cout << UCI::pv(rootPos, rootDepth) << sync_endl;
       }
 
-      if (!Threads.stop)
+      if (!Threads.stop && !maxNodesHit)
           completedDepth = rootDepth;
 
       if (rootMoves[0].pv[0] != lastBestMove)
@@ -542,10 +713,21 @@ void Thread::search() {
       if (!mainThread)
           continue;
 
-      // If the skill level is enabled and time is up, pick a sub-optimal best move
+      // If the skill level is enabled and time is up, pick a sub-optimal best move.
+      // Deeper iterations would not change it, so in a game stop searching.
       if (skill.enabled() && skill.time_to_pick(rootDepth))
+      {
           skill.pick_best(multiPV);
 
+          if (!Limits.infinite && !Limits.depth && !Limits.mate)
+          {
+              if (mainThread->ponder)
+                  mainThread->stopOnPonderhit = true;
+              else
+                  Threads.stop = true;
+          }
+      }
+
       // Use part of the gained time from a previous stable move for the current move
       for (Thread* th : Threads)
       {
@@ -659,10 +841,16 @@ int moveCount, captureCount, quietCount, improvement;
     bestValue          = -VALUE_INFINITE;
     maxValue           = VALUE_INFINITE;
 
-    // Check for the available remaining time
+    STATS_INC(STATS_NODES, depth);
+
+    // Check for the available remaining time, or the node limit of a thread
+    // searching on its own
     if (thisThread == Threads.main())
         static_cast<MainThread*>(thisThread)->check_time();
 
+    else if (thisThread->maxNodes && thisThread->nodes.load(std::memory_order_relaxed) >= thisThread->maxNodes)
+        thisThread->maxNodesHit = true;
+
     // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
     if (PvNode && thisThread->selDepth < ss->ply + 1)
         thisThread->selDepth = ss->ply + 1;
@@ -671,6 +859,7 @@ int moveCount, captureCount, quietCount, improvement;
     {
         // Step 2. Check for aborted search and immediate draw
         if (   Threads.stop.load(std::memory_order_relaxed)
+            || thisThread->maxNodesHit
             || pos.is_draw(ss->ply)
             || ss->ply >= MAX_PLY)
             return (ss->ply >= MAX_PLY && !ss->inCheck) ? evaluate(pos)
@@ -702,7 +891,7 @@ int moveCount, captureCount, quietCount, improvement;
     // Step 4. Transposition table lookup.
     excludedMove = ss->excludedMove;
     posKey = pos.key();
-    tte = TT.probe(posKey, ss->ttHit);
+    tte = thisThread->tt->probe(posKey, ss->ttHit);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
             : ss->ttHit    ? tte->move() : MOVE_NONE;
@@ -745,7 +934,10 @@ int moveCount, captureCount, quietCount, improvement;
         // Partial workaround for the graph history interaction problem
         // For high rule50 counts don't produce transposition table cutoffs.
         if (pos.rule50_count() < 90)
+        {
+            STATS_INC(STATS_TT_CUTOFF, depth);
             return ttValue;
+        }
     }
 
     CapturePieceToHistory& captureHistory = thisThread->captureHistory;
@@ -779,7 +971,8 @@ int moveCount, captureCount, quietCount, improvement;
     {
         ss->staticEval = eval = evaluate(pos);
         // Save static evaluation into the transposition table
-        tte->save(posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval);
+        tte->save(posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval,
+                  thisThread->tt->generation());
     }
 
     // Use static evaluation difference to improve quiet move ordering (~4 Elo)
@@ -805,7 +998,10 @@ int moveCount, captureCount, quietCount, improvement;
     {
         value = qsearch<NonPV>(pos, ss, alpha - 1, alpha);
         if (value < alpha)
+        {
+            STATS_INC(STATS_RAZORING, depth);
             return value;
+        }
     }
 
     // Step 8. Futility pruning: child node (~40 Elo).
@@ -815,7 +1011,10 @@ int moveCount, captureCount, quietCount, improvement;
         &&  eval - futility_margin(depth, improving) - (ss-1)->statScore / 306 >= beta
         &&  eval >= beta
         &&  eval < 24923) // larger than VALUE_KNOWN_WIN, but smaller than TB wins
+    {
+        STATS_INC(STATS_FUTILITY, depth);
         return eval;
+    }
 
     // Step 9. Null move search with verification search (~35 Elo)
     if (   !PvNode
@@ -831,6 +1030,8 @@ int moveCount, captureCount, quietCount, improvement;
     {
         assert(eval - beta >= 0);
 
+        STATS_INC(STATS_NULL_TRY, depth);
+
         // Null move dynamic reduction based on depth and eval
         Depth R = std::min(int(eval - beta) / 173, 6) + depth / 3 + 4;
 
@@ -849,10 +1050,15 @@ int moveCount, captureCount, quietCount, improvement;
             nullValue = std::min(nullValue, VALUE_TB_WIN_IN_MAX_PLY-1);
 
             if (thisThread->nmpMinPly || depth < 14)
+            {
+                STATS_INC(STATS_NULL_CUTOFF, depth);
                 return nullValue;
+            }
 
             assert(!thisThread->nmpMinPly); // Recursive verification is not allowed
 
+            STATS_INC(STATS_NULL_VERIFY, depth);
+
             // Do verification search at high depths, with null move pruning disabled
             // until ply exceeds nmpMinPly.
             thisThread->nmpMinPly = ss->ply + 3 * (depth-R) / 4;
@@ -862,7 +1068,10 @@ int moveCount, captureCount, quietCount, improvement;
             thisThread->nmpMinPly = 0;
 
             if (v >= beta)
+            {
+                STATS_INC(STATS_NULL_CUTOFF, depth);
                 return nullValue;
+            }
         }
     }
 
@@ -926,7 +1135,9 @@ int moveCount, captureCount, quietCount, improvement;
                 if (value >= probCutBeta)
                 {
                     // Save ProbCut data into transposition table
-                    tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, BOUND_LOWER, depth - 3, move, ss->staticEval);
+                    tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, BOUND_LOWER, depth - 3, move,
+                              ss->staticEval, thisThread->tt->generation());
+                    STATS_INC(STATS_PROBCUT, depth);
                     return value;
                 }
             }
@@ -944,7 +1155,10 @@ moves_loop: // When in check, search starts here
         && ttValue >= probCutBeta
         && abs(ttValue) <= VALUE_KNOWN_WIN
         && abs(beta) <= VALUE_KNOWN_WIN)
+    {
+        STATS_INC(STATS_PROBCUT_CHECK, depth);
         return probCutBeta;
+    }
 
     const PieceToHistory* contHist[] = { (ss-1)->continuationHistory, (ss-2)->continuationHistory,
                                           nullptr                   , (ss-4)->continuationHistory,
@@ -968,9 +1182,23 @@ moves_loop: // When in check, search starts here
                          && (tte->bound() & BOUND_UPPER)
                          && tte->depth() >= depth;
 
+    // In a one pass MultiPV search the first kBest root moves are PV moves, and
+    // alpha is then kept at the k-th best score instead of the best one.
+    const size_t kBest = rootNode ? thisThread->multiPVWidth : 1;
+    const Value rootAlpha = alpha;
+
+    const bool deferMoves = Abdada && !rootNode && !excludedMove && depth >= AbdadaDepth;
+    Move deferred[MaxDeferred];
+    int deferredCount = 0, deferredIdx = 0;
+    bool deferredPass = false;
+    Key moveKey = 0;
+
     // Step 13. Loop through all pseudo-legal moves until no moves remain
-    // or a beta cutoff occurs.
-    while ((move = mp.next_move(moveCountPruning)) != MOVE_NONE)
+    // or a beta cutoff occurs. The moves deferred by ABDADA come last.
+    while (   (!deferredPass && (move = mp.next_move(moveCountPruning)) != MOVE_NONE)
+           || (   (deferredPass = true)
+               && deferredIdx < deferredCount
+               && (move = deferred[deferredIdx++]) != MOVE_NONE))
     {
       assert(is_ok(move));
 
@@ -989,6 +1217,21 @@ moves_loop: // When in check, search starts here
       if (!rootNode && !pos.legal(move))
           continue;
 
+      // Defer the move if another thread is searching it, but never the first one
+      if (deferMoves)
+      {
+          moveKey = searching_key(posKey, move);
+
+          if (   !deferredPass
+              && moveCount
+              && deferredCount < MaxDeferred
+              && searched_elsewhere(moveKey))
+          {
+              deferred[deferredCount++] = move;
+              continue;
+          }
+      }
+
       ss->moveCount = ++moveCount;
 
       if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000)
@@ -998,6 +1241,8 @@ moves_loop: // When in check, search starts here
       if (PvNode)
           (ss+1)->pv = nullptr;
 
+      bool pvMove = moveCount == 1 || (rootNode && size_t(moveCount) <= kBest);
+
       extension = 0;
       capture = pos.capture_stage(move);
       movedPiece = pos.moved_piece(move);
@@ -1109,12 +1354,16 @@ moves_loop: // When in check, search starts here
               Value singularBeta = ttValue - (82 + 65 * (ss->ttPv && !PvNode)) * depth / 64;
               Depth singularDepth = (depth - 1) / 2;
 
+              STATS_INC(STATS_SINGULAR_TRY, depth);
+
               ss->excludedMove = move;
               value = search<NonPV>(pos, ss, singularBeta - 1, singularBeta, singularDepth, cutNode);
               ss->excludedMove = MOVE_NONE;
 
               if (value < singularBeta)
               {
+                  STATS_INC(STATS_SINGULAR_EXT, depth);
+
                   extension = 1;
                   singularQuietLMR = !ttCapture;
 
@@ -1123,6 +1372,7 @@ moves_loop: // When in check, search starts here
                       && value < singularBeta - 21
                       && ss->doubleExtensions <= 11)
                   {
+                      STATS_INC(STATS_DOUBLE_EXT, depth);
                       extension = 2;
                       depth += depth < 13;
                   }
@@ -1134,7 +1384,10 @@ moves_loop: // When in check, search starts here
               // that multiple moves fail high, and we can prune the whole subtree by returning
               // a softbound.
               else if (singularBeta >= beta)
+              {
+                  STATS_INC(STATS_MULTICUT, depth);
                   return singularBeta;
+              }
 
               // If the eval of ttMove is greater than beta, we reduce it (negative extension) (~7 Elo)
               else if (ttValue >= beta)
@@ -1171,7 +1424,7 @@ moves_loop: // When in check, search starts here
       ss->doubleExtensions = (ss-1)->doubleExtensions + (extension == 2);
 
       // Speculative prefetch as early as possible
-      prefetch(TT.first_entry(pos.key_after(move)));
+      prefetch(thisThread->tt->first_entry(pos.key_after(move)));
 
       // Update the current move (this must be done after singular extension search)
       ss->currentMove = move;
@@ -1180,6 +1433,9 @@ moves_loop: // When in check, search starts here
                                                                 [movedPiece]
                                                                 [to_sq(move)];
 
+      if (deferMoves)
+          start_searching_move(moveKey);
+
       // Step 16. Make the move
       pos.do_move(move, st, givesCheck);
 
@@ -1232,6 +1488,7 @@ moves_loop: // When in check, search starts here
       // cases where we extend a son if it has good chances to be "interesting".
       if (    depth >= 2
           &&  moveCount > 1 + (PvNode && ss->ply <= 1)
+          && !pvMove
           && (   !ss->ttPv
               || !capture
               || (cutNode && (ss-1)->moveCount > 1)))
@@ -1241,6 +1498,8 @@ moves_loop: // When in check, search starts here
           // beyond the first move depth. This may lead to hidden double extensions.
           Depth d = std::clamp(newDepth - r, 1, newDepth + 1);
 
+          STATS_INC(STATS_LMR, depth);
+
           value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, d, true);
 
           // Do a full-depth search when reduced LMR search fails high
@@ -1257,7 +1516,10 @@ moves_loop: // When in check, search starts here
               newDepth += doDeeperSearch - doShallowerSearch + doEvenDeeperSearch;
 
               if (newDepth > d)
+              {
+                  STATS_INC(STATS_LMR_RESEARCH, depth);
                   value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, newDepth, !cutNode);
+              }
 
               int bonus = value <= alpha ? -stat_bonus(newDepth)
                         : value >= beta  ?  stat_bonus(newDepth)
@@ -1268,7 +1530,7 @@ moves_loop: // When in check, search starts here
       }
 
       // Step 18. Full-depth search when LMR is skipped. If expected reduction is high, reduce its depth by 1.
-      else if (!PvNode || moveCount > 1)
+      else if (!PvNode || !pvMove)
       {
           // Increase reduction for cut nodes and not ttMove (~1 Elo)
           if (!ttMove && cutNode)
@@ -1280,7 +1542,7 @@ moves_loop: // When in check, search starts here
       // For PV nodes only, do a full PV search on the first move or after a fail
       // high (in the latter case search only if value < beta), otherwise let the
       // parent node fail low with value <= alpha and try another move.
-      if (PvNode && (moveCount == 1 || (value > alpha && (rootNode || value < beta))))
+      if (PvNode && (pvMove || (value > alpha && (rootNode || value < beta))))
       {
           (ss+1)->pv = pv;
           (ss+1)->pv[0] = MOVE_NONE;
@@ -1291,13 +1553,16 @@ moves_loop: // When in check, search starts here
       // Step 19. Undo move
       pos.undo_move(move);
 
+      if (deferMoves)
+          finish_searching_move(moveKey);
+
       assert(value > -VALUE_INFINITE && value < VALUE_INFINITE);
 
       // Step 20. Check for a new best move
       // Finished searching the move. If a stop occurred, the return value of
       // the search cannot be trusted, and we return immediately without
       // updating best move, PV and TT.
-      if (Threads.stop.load(std::memory_order_relaxed))
+      if (Threads.stop.load(std::memory_order_relaxed) || thisThread->maxNodesHit)
           return VALUE_ZERO;
 
       if (rootNode)
@@ -1308,7 +1573,7 @@ moves_loop: // When in check, search starts here
           rm.averageScore = rm.averageScore != -VALUE_INFINITE ? (2 * value + rm.averageScore) / 3 : value;
 
           // PV move or new best move?
-          if (moveCount == 1 || value > alpha)
+          if (pvMove || value > alpha)
           {
               rm.score =  rm.uciScore = value;
               rm.selDepth = thisThread->selDepth;
@@ -1336,7 +1601,8 @@ moves_loop: // When in check, search starts here
               // This information is used for time management. In MultiPV mode,
               // we must take care to only do this for the first PV line.
               if (   moveCount > 1
-                  && !thisThread->pvIdx)
+                  && !thisThread->pvIdx
+                  && value > bestValue)
                   ++thisThread->bestMoveChanges;
           }
           else
@@ -1369,7 +1635,8 @@ moves_loop: // When in check, search starts here
                   if (   depth > 2
                       && depth < 12
                       && beta  <  14362
-                      && value > -12393)
+                      && value > -12393
+                      && kBest == 1)
                       depth -= 2;
 
                   assert(depth > 0);
@@ -1378,6 +1645,9 @@ moves_loop: // When in check, search starts here
           }
       }
 
+      if (rootNode && kBest > 1)
+          alpha = std::max(rootAlpha, kth_best_score(thisThread->rootMoves, kBest));
+
 
       // If the move is worse than some previously searched move, remember it, to update its stats later
       if (move != bestMove)
@@ -1435,7 +1705,7 @@ moves_loop: // When in check, search starts here
         tte->save(posKey, value_to_tt(bestValue, ss->ply), ss->ttPv,
                   bestValue >= beta ? BOUND_LOWER :
                   PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
-                  depth, bestMove, ss->staticEval);
+                  depth, bestMove, ss->staticEval, thisThread->tt->generation());
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1479,6 +1749,8 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
     ss->inCheck = pos.checkers();
     moveCount = 0;
 
+    STATS_INC(STATS_QS_NODES, 0);
+
     // Step 2. Check for an immediate draw or maximum ply reached
     if (   pos.is_draw(ss->ply)
         || ss->ply >= MAX_PLY)
@@ -1494,7 +1766,7 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
 
     // Step 3. Transposition table lookup
     posKey = pos.key();
-    tte = TT.probe(posKey, ss->ttHit);
+    tte = thisThread->tt->probe(posKey, ss->ttHit);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove = ss->ttHit ? tte->move() : MOVE_NONE;
     pvHit = ss->ttHit && tte->is_pv();
@@ -1504,7 +1776,10 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
         && tte->depth() >= ttDepth
         && ttValue != VALUE_NONE // Only in case of TT access race or if !ttHit
         && (tte->bound() & (ttValue >= beta ? BOUND_LOWER : BOUND_UPPER)))
+    {
+        STATS_INC(STATS_QS_TT_CUTOFF, 0);
         return ttValue;
+    }
 
     // Step 4. Static evaluation of the position
     if (ss->inCheck)
@@ -1533,8 +1808,9 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
             // Save gathered info in transposition table
             if (!ss->ttHit)
                 tte->save(posKey, value_to_tt(bestValue, ss->ply), false, BOUND_LOWER,
-                          DEPTH_NONE, MOVE_NONE, ss->staticEval);
+                          DEPTH_NONE, MOVE_NONE, ss->staticEval, thisThread->tt->generation());
 
+            STATS_INC(STATS_QS_STAND_PAT, 0);
             return bestValue;
         }
 
@@ -1620,7 +1896,7 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
         }
 
         // Speculative prefetch as early as possible
-        prefetch(TT.first_entry(pos.key_after(move)));
+        prefetch(thisThread->tt->first_entry(pos.key_after(move)));
 
         // Update the current move
         ss->currentMove = move;
@@ -1671,7 +1947,7 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
     // Save gathered info in transposition table
     tte->save(posKey, value_to_tt(bestValue, ss->ply), pvHit,
               bestValue >= beta ? BOUND_LOWER : BOUND_UPPER,
-              ttDepth, bestMove, ss->staticEval);
+              ttDepth, bestMove, ss->staticEval, thisThread->tt->generation());
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1870,7 +2146,9 @@ void MainThread::check_time() {
       return;
 
   // When using nodes, ensure checking rate is not lower than 0.1% of nodes
-  callsCnt = Limits.nodes ? std::min(1024, int(Limits.nodes / 1024)) : 1024;
+  callsCnt = Limits.nodes ? std::min(1024, int(Limits.nodes / 1024)) : Time.poll_interval(Threads.size());
+
+  Time.poll();
 
   static TimePoint lastInfoTime = now();
 
@@ -1889,7 +2167,8 @@ void MainThread::check_time() {
 
   if (   (Limits.use_time_management() && (elapsed > Time.maximum() - 10 || stopOnPonderhit))
       || (Limits.movetime && elapsed >= Limits.movetime)
-      || (Limits.nodes && Threads.nodes_searched() >= (uint64_t)Limits.nodes))
+      || (Limits.nodes && Threads.nodes_searched() >= (uint64_t)Limits.nodes)
+      || (Time.nodeBudget && Threads.nodes_searched() >= Time.nodeBudget))
       Threads.stop = true;
 }
 
@@ -1978,4 +2257,75 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
     return pv.size() > 1;
 }
 
-}  // namespace Hypnos
\ No newline at end of file
+
+/// Search::stats_clear() resets the search statistics of all the threads
+
+void Search::stats_clear() {
+
+#ifdef SEARCH_STATS
+  for (Thread* th : Threads)
+      std::memset(th->searchStats, 0, sizeof(th->searchStats));
+#endif
+}
+
+
+/// Search::stats_print() prints the search statistics summed over all the
+/// threads: the total of each event and its rate per node of the search (or of
+/// qsearch for the qsearch events), then, with 'perDepth', the counts of every
+/// event at each remaining depth.
+
+void Search::stats_print(std::ostream& os, bool perDepth) {
+
+#ifdef SEARCH_STATS
+  static const char* Names[STATS_EVENT_NB] = {
+      "nodes", "tt cut", "razor", "futility", "null try", "null cut", "verify",
+      "probcut", "pc check", "sing try", "singular", "double", "multicut",
+      "lmr", "lmr re", "qnodes", "qs tt cut", "stand pat" };
+
+  SearchStats sum = {};
+
+  for (Thread* th : Threads)
+      for (int e = 0; e < STATS_EVENT_NB; ++e)
+          for (int d = 0; d < STATS_DEPTH_NB; ++d)
+              sum[e][d] += th->searchStats[e][d];
+
+  auto total = [&](int e) { uint64_t t = 0; for (uint64_t c : sum[e]) t += c; return t; };
+
+  const uint64_t nodes = total(STATS_NODES), qnodes = total(STATS_QS_NODES);
+
+  std::ostringstream ss;
+
+  ss << "Search stats    : " << nodes << " nodes, " << qnodes << " qsearch nodes";
+
+  for (int e = STATS_TT_CUTOFF; e < STATS_EVENT_NB; ++e)
+      if (e != STATS_QS_NODES)
+      {
+          uint64_t n = e >= STATS_QS_NODES ? qnodes : nodes;
+          ss << "\n  " << std::left << std::setw(14) << Names[e] << std::right
+             << std::setw(12) << total(e) << std::setw(9) << std::fixed << std::setprecision(2)
+             << (n ? 100.0 * total(e) / n : 0.0) << "%";
+      }
+
+  if (perDepth)
+  {
+      ss << "\n\n" << std::setw(5) << "depth";
+      for (int e = 0; e < STATS_EVENT_NB; ++e)
+          ss << std::setw(11) << Names[e];
+
+      for (int d = 0; d < STATS_DEPTH_NB; ++d)
+          if (sum[STATS_NODES][d] || sum[STATS_QS_NODES][d])
+          {
+              ss << "\n" << std::setw(4) << d << (d == STATS_DEPTH_NB - 1 ? "+" : " ");
+              for (int e = 0; e < STATS_EVENT_NB; ++e)
+                  ss << std::setw(11) << sum[e][d];
+          }
+  }
+
+  os << ss.str();
+#else
+  (void)perDepth;
+  os << "Search stats    : not compiled in, build with 'make build searchstats=yes'";
+#endif
+}
+
+}  // namespace Hypnos
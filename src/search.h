@@ -19,6 +19,7 @@
 #ifndef SEARCH_H_INCLUDED
 #define SEARCH_H_INCLUDED
 
+#include <iosfwd>
 #include <vector>
 
 #include "misc.h"
@@ -109,6 +110,29 @@ extern LimitsType Limits;
 void init();
 void clear();
 
+
+/// Search statistics count how often each pruning, reduction and extension
+/// step of the search fires, per thread and per remaining depth. They cost a
+/// few increments per node, so they are only compiled in with SEARCH_STATS
+/// ('make build searchstats=yes'), and the functions below just say so otherwise.
+
+enum StatsEvent {
+  STATS_NODES, STATS_TT_CUTOFF, STATS_RAZORING, STATS_FUTILITY,
+  STATS_NULL_TRY, STATS_NULL_CUTOFF, STATS_NULL_VERIFY,
+  STATS_PROBCUT, STATS_PROBCUT_CHECK,
+  STATS_SINGULAR_TRY, STATS_SINGULAR_EXT, STATS_DOUBLE_EXT, STATS_MULTICUT,
+  STATS_LMR, STATS_LMR_RESEARCH,
+  STATS_QS_NODES, STATS_QS_TT_CUTOFF, STATS_QS_STAND_PAT,
+  STATS_EVENT_NB
+};
+
+constexpr int STATS_DEPTH_NB = 32; // Depth 0 is qsearch, the last one collects the deeper nodes
+
+using SearchStats = uint64_t[STATS_EVENT_NB][STATS_DEPTH_NB];
+
+void stats_clear();
+void stats_print(std::ostream& os, bool perDepth);
+
 } // namespace Search
 
 } // namespace Hypnos
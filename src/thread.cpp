@@ -17,6 +17,7 @@
 */
 
 #include <cassert>
+#include <new>       // For std::bad_alloc
 
 #include <algorithm> // For std::count
 #include "movegen.h"
@@ -52,9 +53,29 @@ Thread::~Thread() {
 }
 
 
-/// Thread::clear() reset histories, usually before a new game
+/// Thread::operator new() places the thread object, and so its history tables,
+/// in large pages when possible, to reduce TLB misses during the search.
 
-void Thread::clear() {
+void* Thread::operator new(size_t size) {
+
+  void* mem = aligned_large_pages_alloc(size);
+  if (!mem)
+      throw std::bad_alloc();
+
+  return mem;
+}
+
+
+/// Thread::clear() reset histories, usually before a new game. A lazy reset is
+/// postponed to the next search of the thread, so that the history tables of an
+/// idle engine are never touched and thus never backed by physical memory.
+
+void Thread::clear(bool lazy) {
+
+  historyPending = lazy;
+
+  if (lazy)
+      return;
 
   counterMoves.fill(MOVE_NONE);
   mainHistory.fill(0);
@@ -68,6 +89,27 @@ void Thread::clear() {
 }
 
 
+/// Thread::save_histories() and Thread::load_histories() copy the history
+/// tables out and in, for games that take turns on the thread.
+
+void Thread::save_histories(GameState::Histories& h) const {
+
+  h.counterMoves = counterMoves;
+  h.mainHistory = mainHistory;
+  h.captureHistory = captureHistory;
+  std::copy(&continuationHistory[0][0], &continuationHistory[0][0] + 4, &h.continuationHistory[0][0]);
+}
+
+void Thread::load_histories(const GameState::Histories& h) {
+
+  historyPending = false;
+  counterMoves = h.counterMoves;
+  mainHistory = h.mainHistory;
+  captureHistory = h.captureHistory;
+  std::copy(&h.continuationHistory[0][0], &h.continuationHistory[0][0] + 4, &continuationHistory[0][0]);
+}
+
+
 /// Thread::start_searching() wakes up the thread that will start the search
 
 void Thread::start_searching() {
@@ -78,6 +120,22 @@ void Thread::start_searching() {
 }
 
 
+/// Thread::run_custom_job() wakes up the thread to run the given function in
+/// place of a search, so that work like clearing the per-thread tables can be
+/// done by each thread in parallel, and with the memory touched first locally.
+
+void Thread::run_custom_job(std::function<void()> f) {
+
+  {
+      std::unique_lock<std::mutex> lk(mutex);
+      cv.wait(lk, [&]{ return !searching; });
+      jobFunc = std::move(f);
+      searching = true;
+  }
+  cv.notify_one();
+}
+
+
 /// Thread::wait_for_search_finished() blocks on the condition variable
 /// until the thread has finished searching.
 
@@ -106,17 +164,59 @@ void Thread::idle_loop() {
       std::unique_lock<std::mutex> lk(mutex);
       searching = false;
       cv.notify_one(); // Wake up anyone waiting for search finished
-      cv.wait(lk, [&]{ return searching; });
+
+      // Spin for a while before parking, so that at fast time controls the
+      // next search is picked up without the wake-up latency.
+      lk.unlock();
+      Threads.spin_until([&]{ return searching.load(std::memory_order_acquire); });
+      lk.lock();
+
+      cv.wait(lk, [&]{ return bool(searching); });
 
       if (exit)
           return;
 
+      std::function<void()> job = std::move(jobFunc);
+      jobFunc = nullptr;
+
       lk.unlock();
 
-      search();
+      if (job)
+          job();
+      else
+          search();
   }
 }
 
+/// MainThread::wait_for_stop_or_ponderhit() is called when the search is over
+/// while pondering or in an infinite search. The UCI protocol then requires
+/// waiting for "stop" or "ponderhit" before sending the best move. We spin for
+/// the configured time, for a fast ponderhit reply, and then park the thread
+/// until wake_up() is called, so that a pondering engine does not burn a core.
+
+void MainThread::wait_for_stop_or_ponderhit() {
+
+  auto done = [&]{ return Threads.stop || !(ponder || Search::Limits.infinite); };
+
+  if (Threads.spin_until(done))
+      return;
+
+  std::unique_lock<std::mutex> lk(waitMutex);
+  waitCv.wait(lk, done);
+}
+
+
+/// MainThread::wake_up() is called after raising Threads.stop or resetting
+/// ponder from the UCI thread. Notifying under the lock ensures the wake up
+/// is not lost between the check of the condition and the wait.
+
+void MainThread::wake_up() {
+
+  std::lock_guard<std::mutex> lk(waitMutex);
+  waitCv.notify_one();
+}
+
+
 /// ThreadPool::set() creates/destroys threads to match the requested number.
 /// Created and launched threads will immediately go to sleep in idle_loop.
 /// Upon resizing, threads are recreated to allow for binding if necessary.
@@ -137,7 +237,12 @@ void ThreadPool::set(size_t requested) {
 
       while (threads.size() < requested)
           threads.push_back(new Thread(threads.size()));
-      clear();
+      resize_eval_tables();
+
+      // The history tables are filled by each thread at its first search, so
+      // that starting the engine or changing the thread count stays cheap.
+      for (Thread* th : threads)
+          th->clear(true);
 
       // Reallocate the hash with the new threadpool size
       TT.resize(size_t(Options["Hash"]));
@@ -148,12 +253,39 @@ void ThreadPool::set(size_t requested) {
 }
 
 
-/// ThreadPool::clear() sets threadPool data to initial values
+/// ThreadPool::resize_eval_tables() sizes the pawn and material hash tables
+/// of every thread according to the UCI options. The tables are allocated and
+/// zeroed by the threads that own them, so that the memory is local to them.
+
+void ThreadPool::resize_eval_tables() {
+
+  size_t pawnKB = size_t(Options["Pawn Hash"]), materialKB = size_t(Options["Material Hash"]);
+
+  main()->wait_for_search_finished();
+
+  for (Thread* th : threads)
+      th->run_custom_job([th, pawnKB, materialKB]() {
+          th->pawnsTable.resize(pawnKB);
+          th->materialTable.resize(materialKB);
+      });
+
+  for (Thread* th : threads)
+      th->wait_for_search_finished();
+}
+
+
+/// ThreadPool::clear() sets threadPool data to initial values. Each thread
+/// resets its own tables, all in parallel.
 
 void ThreadPool::clear() {
 
+  bool lazy = Options["Low Memory"];
+
   for (Thread* th : threads)
-      th->clear();
+      th->run_custom_job([th, lazy]() { th->clear(lazy); });
+
+  for (Thread* th : threads)
+      th->wait_for_search_finished();
 
   main()->callsCnt = 0;
   main()->bestPreviousScore = VALUE_INFINITE;
@@ -162,6 +294,72 @@ void ThreadPool::clear() {
 }
 
 
+/// ThreadPool::save_game() copies the search state of the game played on the
+/// pool into the given GameState, and load_game() puts it back, so that games
+/// taking turns on the pool don't see each other's histories. Each thread
+/// copies its own tables, all in parallel.
+
+void ThreadPool::save_game(GameState& game) const {
+
+  main()->wait_for_search_finished();
+
+  game.histories.resize(threads.size());
+
+  for (size_t i = 0; i < threads.size(); ++i)
+  {
+      Thread* th = threads[i];
+
+      if (th->history_pending())
+      {
+          game.histories[i].reset();
+          continue;
+      }
+
+      if (!game.histories[i])
+          game.histories[i] = std::make_unique<GameState::Histories>();
+
+      th->run_custom_job([th, h = game.histories[i].get()]() { th->save_histories(*h); });
+  }
+
+  for (Thread* th : threads)
+      th->wait_for_search_finished();
+
+  game.previousTimeReduction = main()->previousTimeReduction;
+  game.bestPreviousScore = main()->bestPreviousScore;
+  game.bestPreviousAverageScore = main()->bestPreviousAverageScore;
+  std::copy(std::begin(main()->iterValue), std::end(main()->iterValue), game.iterValue);
+}
+
+void ThreadPool::load_game(const GameState& game) {
+
+  main()->wait_for_search_finished();
+
+  // Tables of a new game, or of threads added since, are cleared lazily
+  for (size_t i = 0; i < threads.size(); ++i)
+  {
+      Thread* th = threads[i];
+      const GameState::Histories* h = i < game.histories.size() ? game.histories[i].get() : nullptr;
+
+      if (!h)
+      {
+          th->clear(true);
+          continue;
+      }
+
+      th->run_custom_job([th, h]() { th->load_histories(*h); });
+  }
+
+  for (Thread* th : threads)
+      th->wait_for_search_finished();
+
+  main()->callsCnt = 0;
+  main()->previousTimeReduction = game.previousTimeReduction;
+  main()->bestPreviousScore = game.bestPreviousScore;
+  main()->bestPreviousAverageScore = game.bestPreviousAverageScore;
+  std::copy(std::begin(game.iterValue), std::end(game.iterValue), main()->iterValue);
+}
+
+
 /// ThreadPool::start_thinking() wakes up main thread waiting in idle_loop() and
 /// returns immediately. Main thread will wake up other threads and start the search.
 
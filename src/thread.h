@@ -20,51 +20,105 @@
 #define THREAD_H_INCLUDED
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
 
+#include "evaluate.h"
 #include "material.h"
 #include "movepick.h"
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
 #include "thread_win32_osx.h"
+#include "tt.h"
 
 namespace Hypnos {
 
+/// GameState is what a game leaves in the pool for its next search: the
+/// histories of each thread and the time management memory of the main thread.
+/// A default GameState stands for a new game.
+
+struct GameState {
+
+  struct Histories {
+    CounterMoveHistory counterMoves;
+    ButterflyHistory mainHistory;
+    CapturePieceToHistory captureHistory;
+    ContinuationHistory continuationHistory[2][2];
+  };
+
+  std::vector<std::unique_ptr<Histories>> histories; // nullptr if still to be cleared
+  double previousTimeReduction = 1.0;
+  Value bestPreviousScore = VALUE_INFINITE;
+  Value bestPreviousAverageScore = VALUE_INFINITE;
+  Value iterValue[4] = {};
+};
+
+
 /// Thread class keeps together all the thread-related stuff. We use
 /// per-thread pawn and material hash tables so that once we get a
 /// pointer to an entry its life time is unlimited and we don't have
-/// to care about someone changing the entry under our feet.
+/// to care about someone changing the entry under our feet. A Thread holds
+/// several MB of history tables, so it is allocated in large pages.
 
 class Thread {
 
   std::mutex mutex;
   std::condition_variable cv;
   size_t idx;
-  bool exit = false, searching = true; // Set before starting std::thread
+  bool exit = false;
+  std::atomic_bool searching = true; // Set before starting std::thread
+  std::function<void()> jobFunc;
+  bool historyPending = false;
   NativeThread stdThread;
 
 public:
   explicit Thread(size_t);
   virtual ~Thread();
   virtual void search();
-  void clear();
+  void clear(bool lazy = false);
   void idle_loop();
   void start_searching();
+  void run_custom_job(std::function<void()> f);
   void wait_for_search_finished();
+  void save_histories(GameState::Histories&) const;
+  void load_histories(const GameState::Histories&);
   size_t id() const { return idx; }
+  bool history_pending() const { return historyPending; }
+
+  static void* operator new(size_t size);
+  static void operator delete(void* mem) { aligned_large_pages_free(mem); }
 
   Pawns::Table pawnsTable;
   Material::Table materialTable;
-  size_t pvIdx, pvLast;
-  std::atomic<uint64_t> nodes, tbHits, bestMoveChanges;
+  size_t pvIdx, pvLast, multiPVWidth;
+  std::atomic<uint64_t> bestMoveChanges;
   int selDepth, nmpMinPly;
   Value bestValue, optimism[COLOR_NB];
+  Depth maxDepth = 0;    // Limits of a thread searching a position on its own
+  uint64_t maxNodes = 0;
+  bool maxNodesHit = false;
+  TranspositionTable* tt = &TT; // Its own table, when not the shared one
+
+#ifdef SEARCH_STATS
+  Search::SearchStats searchStats = {};
+#endif
 
-  Position rootPos;
+#ifdef EVAL_PROFILE
+  Eval::Profile evalProfile = {};
+#endif
+
+  // Node counters are written by the owning thread only and read by the main
+  // thread from check_time(). They have a cache line of their own, so that
+  // those reads do not interfere with the hot members around them.
+  alignas(64) std::atomic<uint64_t> nodes, tbHits;
+
+  alignas(64) Position rootPos;
   StateInfo rootState;
   Search::RootMoves rootMoves;
   Depth rootDepth, completedDepth;
@@ -84,14 +138,22 @@ struct MainThread : public Thread {
 
   void search() override;
   void check_time();
+  void wait_for_stop_or_ponderhit();
+  void wake_up();
+
+  // Initialized here as ThreadPool::set() no longer clears a new pool, the
+  // first search of a pool must find the state of a new game.
+  double previousTimeReduction = 1.0;
+  Value bestPreviousScore = VALUE_INFINITE;
+  Value bestPreviousAverageScore = VALUE_INFINITE;
+  Value iterValue[4] = {};
+  int callsCnt = 0;
+  bool stopOnPonderhit = false;
+  std::atomic_bool ponder = false;
 
-  double previousTimeReduction;
-  Value bestPreviousScore;
-  Value bestPreviousAverageScore;
-  Value iterValue[4];
-  int callsCnt;
-  bool stopOnPonderhit;
-  std::atomic_bool ponder;
+private:
+  std::mutex waitMutex;
+  std::condition_variable waitCv;
 };
 
 
@@ -104,6 +166,9 @@ struct ThreadPool {
   void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
   void clear();
   void set(size_t);
+  void resize_eval_tables();
+  void save_game(GameState&) const;
+  void load_game(const GameState&);
 
   MainThread* main()        const { return static_cast<MainThread*>(threads.front()); }
   uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
@@ -113,6 +178,22 @@ struct ThreadPool {
   void wait_for_search_finished() const;
 
   std::atomic_bool stop, increaseDepth;
+  std::atomic<int> spinTime; // In microseconds
+
+  // spin_until() busy waits until pred() is true or the spin time is over, so
+  // that short waits avoid the latency of parking on a condition variable.
+  template<typename Pred>
+  bool spin_until(Pred pred) const {
+
+    auto end =  std::chrono::steady_clock::now()
+              + std::chrono::microseconds(spinTime.load(std::memory_order_relaxed));
+
+    while (!pred())
+        if (std::chrono::steady_clock::now() >= end)
+            return false;
+
+    return true;
+  }
 
   auto cbegin() const noexcept { return threads.cbegin(); }
   auto begin() noexcept { return threads.begin(); }
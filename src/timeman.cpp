@@ -19,7 +19,11 @@
 #include <algorithm>
 #include <cfloat>
 #include <cmath>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
 
+#include "evaluate.h"
 #include "search.h"
 #include "timeman.h"
 #include "uci.h"
@@ -36,9 +40,28 @@ TimeManagement Time; // Our global time management object
 
 void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
 
+  // The personality's calculation strength is a node budget per move, about
+  // twice what an iterative search to 1 + CalculationDepth plies needs on
+  // average, for each search thread as the budget counts the nodes of all of
+  // them. Players on a losing streak calculate up to 3 plies further, and the
+  // maximum CalculationDepth leaves the search to the clock alone.
+  int calculationDepth = Eval::activePersonality.get_evaluation_param("CalculationDepth", 0);
+  int streakBonus = Eval::loss_streak > 5 ? std::min(Eval::loss_streak / 2, 3) : 0;
+
+  nodeBudget =   calculationDepth > 0 && calculationDepth < MaxCalculationDepth
+              && !limits.nodes && (limits.time[us] || limits.movetime)
+               ? uint64_t(32 * std::pow(1.8, 1 + calculationDepth + streakBonus)) * Threads.size() : 0;
+
   // if we have no time, no need to initialize TM, except for the start time,
   // which is used by movetime.
   startTime = limits.startTime;
+  clockTime = limits.npmsec ? 0 : limits.time[us];
+
+  calibrating = Options["Calibrate Time"] && (limits.time[us] || limits.movetime);
+  lastPoll    = now();
+  startLag    = lastPoll - limits.startTime;
+  maxPollGap  = 0;
+
   if (limits.time[us] == 0)
       return;
 
@@ -46,6 +69,18 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
   TimePoint slowMover       = TimePoint(Options["Slow Mover"]);
   TimePoint npmsec          = TimePoint(Options["nodestime"]);
 
+  // With calibration, the option is a floor for the overhead measured on this
+  // host, and 'nodes as time' never counts on more than half the measured speed.
+  if (calibrating)
+  {
+      moveOverhead = std::max(moveOverhead, measuredOverhead);
+
+      if (npmsec && nodesPerMs > 0)
+          npmsec = std::clamp(TimePoint(nodesPerMs / 2), TimePoint(1), npmsec);
+  }
+
+  overhead = moveOverhead;
+
   // optScale is a percentage of available time to use for the current move.
   // maxScale is a multiplier applied to optimumTime.
   double optScale, maxScale;
@@ -57,7 +92,14 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
   if (npmsec)
   {
       if (!availableNodes) // Only once at game start
-          availableNodes = npmsec * limits.time[us]; // Time is in msec
+          availableNodes = npmsec * limits.time[us], availableNodesRate = npmsec; // Time is in msec
+
+      // The bank of nodes follows a calibrated speed, at the rate it was set at
+      else if (npmsec != availableNodesRate)
+      {
+          availableNodes = availableNodes * npmsec / std::max(availableNodesRate, TimePoint(1));
+          availableNodesRate = npmsec;
+      }
 
       // Convert from milliseconds to nodes
       limits.time[us] = TimePoint(availableNodes);
@@ -106,4 +148,132 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
       optimumTime += optimumTime / 4;
 }
 
+
+/// TimeManagement::record_move() is called just before sending 'bestmove' of
+/// a search on the clock and adds the time from 'go' to now to the statistics.
+
+void TimeManagement::record_move() {
+
+  if (!clockTime)
+      return;
+
+  TimePoint elapsed  = now() - startTime;
+  TimePoint margin   = clockTime - elapsed;
+  TimePoint overshoot = elapsed - maximumTime;
+
+  stats.minClockMargin = stats.moves ? std::min(stats.minClockMargin, margin) : margin;
+  stats.moves++;
+  stats.sumOptimum += optimumTime;
+  stats.sumMaximum += maximumTime;
+  stats.sumElapsed += elapsed;
+  stats.maxElapsed  = std::max(stats.maxElapsed, elapsed);
+  stats.moveOverhead = overhead;
+
+  if (overshoot > 0)
+  {
+      stats.overshoots++;
+      stats.maxOvershoot = std::max(stats.maxOvershoot, overshoot);
+  }
+
+  int b = 0;
+  while (b < TimeStats::LATENCY_NB - 1 && elapsed >= (TimePoint(1) << b))
+      ++b;
+  stats.latency[b]++;
+
+  stats.usage[std::min(int(10 * elapsed / std::max(maximumTime, TimePoint(1))),
+                       TimeStats::USAGE_NB - 1)]++;
+}
+
+
+/// TimeManagement::calibrate() is called after 'bestmove' has been written,
+/// with the time the search was stopped, and updates the measured overhead
+/// and speed with the lag and the nodes of the move. The overhead rises at
+/// once to a new peak and decays slowly, so that a single quiet move does not
+/// undo what a loaded host has shown.
+
+void TimeManagement::calibrate(uint64_t nodes, TimePoint stopped) {
+
+  if (!calibrating)
+      return;
+
+  // 'bestmove' is only queued so far, the lag ends when it has been written
+  wait_for_output();
+
+  TimePoint lag = startLag + maxPollGap + (now() - stopped);
+  measuredOverhead = std::max(lag, (7 * measuredOverhead + lag) / 8);
+
+  // Short searches are dominated by their start up, not a speed sample
+  TimePoint elapsed = stopped - startTime;
+  if (elapsed >= 50)
+  {
+      double nps = double(nodes) / elapsed;
+      nodesPerMs = nodesPerMs > 0 ? (3 * nodesPerMs + nps) / 4 : nps;
+      stats.nodesPerMs = nodesPerMs;
+  }
+}
+
+
+/// TimeManagement::poll_interval() is the number of nodes between two time
+/// polls of the main thread. Once the speed is known it is set to poll about
+/// every millisecond, so that a slow or crowded host still stops in time.
+
+int TimeManagement::poll_interval(size_t threads) const {
+
+  if (!calibrating || nodesPerMs <= 0)
+      return 1024;
+
+  return std::clamp(int(nodesPerMs / threads), 64, 1024);
+}
+
+/// TimeStats::print() prints the time statistics: averages, worst cases and
+/// the histograms of the elapsed time and of its share of the maximum time.
+
+void TimeStats::print(std::ostream& os) const {
+
+  std::ostringstream ss;
+
+  ss << "Time stats      : " << moves << " moves on the clock, Move Overhead " << moveOverhead << " ms";
+
+  if (nodesPerMs > 0)
+      ss << ", calibrated speed " << uint64_t(1000 * nodesPerMs) << " nps";
+
+  if (!moves)
+  {
+      os << ss.str();
+      return;
+  }
+
+  ss << "\n  average       optimum " << sumOptimum / TimePoint(moves)
+     << " ms, maximum "              << sumMaximum / TimePoint(moves)
+     << " ms, elapsed "              << sumElapsed / TimePoint(moves) << " ms"
+     << "\n  worst         elapsed " << maxElapsed << " ms, clock margin " << minClockMargin << " ms"
+     << "\n  overshoots    " << overshoots << " over maximum, worst by " << maxOvershoot << " ms"
+     << "\n\n  elapsed (ms)";
+
+  int last = LATENCY_NB - 1;
+  while (last > 0 && !latency[last])
+      --last;
+
+  for (int b = 0; b <= last; ++b)
+  {
+      std::string range =  b <= 1 ? std::to_string(b)
+                         : b == LATENCY_NB - 1 ? std::to_string(1 << (b - 1)) + "+"
+                         : std::to_string(1 << (b - 1)) + "-" + std::to_string((1 << b) - 1);
+
+      ss << "\n  " << std::setw(14) << range << std::setw(10) << latency[b];
+  }
+
+  ss << "\n\n  % of maximum";
+
+  for (int b = 0; b < USAGE_NB; ++b)
+  {
+      std::string range =  b == USAGE_NB - 1 ? std::to_string(10 * b) + "+"
+                         : std::to_string(10 * b) + "-" + std::to_string(10 * b + 9);
+
+      ss << "\n  " << std::setw(14) << range << std::setw(10) << usage[b];
+  }
+
+  os << ss.str();
+}
+
 } // namespace Hypnos
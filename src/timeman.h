@@ -19,29 +19,87 @@
 #ifndef TIMEMAN_H_INCLUDED
 #define TIMEMAN_H_INCLUDED
 
+#include <algorithm>
+#include <cstdint>
+#include <iosfwd>
+
 #include "misc.h"
 #include "search.h"
 #include "thread.h"
 
 namespace Hypnos {
 
+/// CalculationDepth of a personality ranges up to MaxCalculationDepth, which
+/// stands for an unlimited calculation: no node budget at all.
+constexpr int MaxCalculationDepth = 18;
+
+
+/// TimeStats collects, over the moves played on the clock, how the time spent
+/// from 'go' to 'bestmove' compares with the optimum and maximum time given by
+/// the time management, and how close each move came to losing on time. The
+/// histograms show the spread, so that "Move Overhead" can be tuned per host.
+
+struct TimeStats {
+
+  static constexpr int LATENCY_NB = 20; // Elapsed time, log2 buckets in ms
+  static constexpr int USAGE_NB   = 12; // Elapsed time in 10% of maximum, then over
+
+  void clear() { *this = TimeStats(); }
+  void print(std::ostream& os) const;
+
+  uint64_t moves = 0, overshoots = 0;
+  TimePoint sumOptimum = 0, sumMaximum = 0, sumElapsed = 0;
+  TimePoint maxElapsed = 0, maxOvershoot = 0, minClockMargin = 0;
+  TimePoint moveOverhead = 0;
+  double nodesPerMs = 0;
+  uint64_t latency[LATENCY_NB] = {}, usage[USAGE_NB] = {};
+};
+
+
 /// The TimeManagement class computes the optimal time to think depending on
 /// the maximum available time, the game move number and other parameters.
 
 class TimeManagement {
 public:
   void init(Search::LimitsType& limits, Color us, int ply);
+  void record_move();
+  void calibrate(uint64_t nodes, TimePoint stopped);
+  int poll_interval(size_t threads) const;
+
+  // Called from check_time(), records the longest wait between two polls
+  void poll() {
+    if (calibrating)
+    {
+        TimePoint t = now();
+        maxPollGap = std::max(maxPollGap, t - lastPoll);
+        lastPoll = t;
+    }
+  }
   TimePoint optimum() const { return optimumTime; }
   TimePoint maximum() const { return maximumTime; }
   TimePoint elapsed() const { return Search::Limits.npmsec ?
                                      TimePoint(Threads.nodes_searched()) : now() - startTime; }
 
   int64_t availableNodes; // When in 'nodes as time' mode
+  TimePoint availableNodesRate; // The nodes per ms availableNodes is counted at
+  uint64_t nodeBudget;    // Per move node cap of all the threads in a game, 0 if none
+  TimeStats stats;
 
 private:
   TimePoint startTime;
   TimePoint optimumTime;
   TimePoint maximumTime;
+  TimePoint clockTime;    // Time left on our clock at 'go', 0 if not on the clock
+  TimePoint overhead;
+
+  // Self-calibration with "Calibrate Time": the engine side lag of a move is
+  // the wake-up delay after 'go', the longest gap between two time polls and
+  // the time from the end of the search to 'bestmove' being written by the
+  // output thread, waiting for the helper threads included. measuredOverhead follows its recent peaks.
+  bool calibrating;
+  TimePoint startLag, lastPoll, maxPollGap;
+  TimePoint measuredOverhead;
+  double nodesPerMs;      // Smoothed search speed of all the threads
 };
 
 extern TimeManagement Time;
@@ -16,10 +16,17 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cerrno>
+#include <chrono>
 #include <cstring>   // For std::memset
 #include <iostream>
+#include <numeric>   // For std::gcd
 #include <thread>
 
+#if !defined(_WIN32)
+#include <signal.h>  // For kill()
+#endif
+
 #include "bitboard.h"
 #include "misc.h"
 #include "thread.h"
@@ -31,9 +38,10 @@ namespace Hypnos {
 TranspositionTable TT; // Our global transposition table
 
 /// TTEntry::save() populates the TTEntry with a new node's data, possibly
-/// overwriting an old position. Update is not atomic and can be racy.
+/// overwriting an old position. Update is not atomic and can be racy. The
+/// generation is the one of the table holding the entry.
 
-void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
+void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8) {
 
   // Preserve any existing move for the same position
   if (m || (uint16_t)k != key16)
@@ -49,26 +57,78 @@ void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev)
 
       key16     = (uint16_t)k;
       depth8    = (uint8_t)(d - DEPTH_OFFSET);
-      genBound8 = (uint8_t)(TT.generation8 | uint8_t(pv) << 2 | b);
+      genBound8 = (uint8_t)(generation8 | uint8_t(pv) << 2 | b);
       value16   = (int16_t)v;
       eval16    = (int16_t)ev;
   }
 }
 
 
+/// TranspositionTable::new_search() advances the generation that ages the
+/// entries. With a shared table, the attached processes search at the same
+/// time, so only the owner of the segment advances its generation, the others
+/// adopt it. When the owner is gone, the next process to search takes over.
+
+void TranspositionTable::new_search() {
+
+#if !defined(_WIN32)
+  if (shared)
+  {
+      const int32_t self = int32_t(getpid());
+      int32_t owner = shared->owner.load(std::memory_order_relaxed);
+
+      if (owner != self && (owner <= 0 || (kill(owner, 0) && errno == ESRCH)))
+          shared->owner.compare_exchange_strong(owner, self);
+
+      if (shared->owner.load(std::memory_order_relaxed) == self)
+          shared->generation8 += GENERATION_DELTA; // Lower bits are used for other things
+
+      generation8 = shared->generation8;
+      return;
+  }
+#endif
+
+  generation8 += GENERATION_DELTA; // Lower bits are used for other things
+}
+
+
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
 /// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// The entries of a previous private table are carried over into the new one,
+/// so changing Hash between games does not cost a cold start.
 
 void TranspositionTable::resize(size_t mbSize) {
 
   Threads.main()->wait_for_search_finished();
 
-  aligned_large_pages_free(table);
+  // Keep the old private table alive until its entries have been rehashed
+  Cluster* oldTable = shared ? nullptr : table;
+  size_t oldCount = clusterCount;
+
+  if (shared)
+      release();
+
+  table = nullptr;
+
+  if (!sharedName.empty() && map_shared(mbSize))
+  {
+      aligned_large_pages_free(oldTable);
+      return;
+  }
 
   clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
   table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+
+  // Both tables may not fit at once, retry after giving up the old entries
+  if (!table && oldTable)
+  {
+      aligned_large_pages_free(oldTable);
+      oldTable = nullptr;
+      table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+  }
+
   if (!table)
   {
       std::cerr << "Failed to allocate " << mbSize
@@ -76,14 +136,229 @@ void TranspositionTable::resize(size_t mbSize) {
       exit(EXIT_FAILURE);
   }
 
-  clear();
+  if (oldTable)
+  {
+      rehash(oldTable, oldCount);
+      aligned_large_pages_free(oldTable);
+  }
+  else
+      clear();
+}
+
+
+/// TranspositionTable::rehash() fills the (new) table with the most valuable
+/// entries of oldTable, in a multi-threaded way. Only the low 16 bits of the key
+/// are stored, so the exact cluster of an entry cannot be recomputed. But since
+/// clusters are indexed with mul_hi64(key, clusterCount), a new cluster j can only
+/// receive keys from the old clusters in [j * oldCount / clusterCount,
+/// (j + 1) * oldCount / clusterCount], and we merge those, keeping the entries
+/// with the best replace value. When growing the table, an entry is copied into
+/// all the new clusters its old one spans: the copies in the wrong clusters are
+/// harmless, as they can only match a position through a key16 collision, and
+/// they are aged out like any other entry.
+
+void TranspositionTable::rehash(const Cluster* oldTable, size_t oldCount) {
+
+  const size_t g = std::gcd(oldCount, clusterCount),
+               a = oldCount / g, b = clusterCount / g;
+
+  // Returns x * oldCount / clusterCount rounded down, without overflowing
+  auto scale = [=](size_t x) { return (x / b) * a + (x % b) * a / b; };
+
+  auto replace_value = [this](const TTEntry& e) {
+      return e.depth8 - ((GENERATION_CYCLE + generation8 - e.genBound8) & GENERATION_MASK);
+  };
+
+  std::vector<std::thread> threads;
+
+  for (size_t idx = 0; idx < size_t(Options["Threads"]); ++idx)
+  {
+      threads.emplace_back([=]() {
+
+          // Thread binding gives faster search on systems with a first-touch policy
+          if (Options["Threads"] > 8)
+              WinProcGroup::bindThisThread(idx);
+
+          // Each thread will fill its part of the hash table
+          const size_t stride = size_t(clusterCount / Options["Threads"]),
+                       start  = size_t(stride * idx),
+                       len    = idx != size_t(Options["Threads"]) - 1 ?
+                                stride : clusterCount - start;
+
+          for (size_t j = start; j < start + len; ++j)
+          {
+              Cluster& cl = table[j];
+              std::memset(&cl, 0, sizeof(Cluster));
+
+              for (size_t i = scale(j); i <= std::min(scale(j + 1), oldCount - 1); ++i)
+                  for (const TTEntry& e : oldTable[i].entry)
+                  {
+                      if (!e.depth8)
+                          continue;
+
+                      // Pick the slot with the same key, or else the least valuable one
+                      TTEntry* slot = &cl.entry[0];
+                      for (TTEntry& s : cl.entry)
+                          if (s.key16 == e.key16 || !s.depth8)
+                          {
+                              slot = &s;
+                              break;
+                          }
+                          else if (replace_value(s) < replace_value(*slot))
+                              slot = &s;
+
+                      if (!slot->depth8 || replace_value(e) > replace_value(*slot))
+                          *slot = e;
+                  }
+          }
+      });
+  }
+
+  for (std::thread& th : threads)
+      th.join();
+}
+
+
+/// TranspositionTable::set_shared_name() selects the name of the shared memory
+/// segment holding the table. An empty name (or "<empty>") means a private table.
+
+void TranspositionTable::set_shared_name(const std::string& name) {
+
+  sharedName = name == "<empty>" ? "" : name;
+  resize(size_t(Options["Hash"]));
+}
+
+
+/// TranspositionTable::map_shared() creates, or attaches to, the named POSIX shared
+/// memory segment and maps the table into it. The first process creates the
+/// segment with its own Hash size, later ones adopt that size. The segment is
+/// not unlinked on exit, so it survives as long as the host (or until removed
+/// from /dev/shm). Returns false if the table could not be mapped.
+
+bool TranspositionTable::map_shared(size_t mbSize) {
+
+#if defined(_WIN32)
+
+  sync_cout << "info string Shared Hash is not supported on this platform" << sync_endl;
+  return false;
+
+#else
+
+  constexpr uint64_t Magic = 0x324E5424534F4E59; // Arbitrary, marks a ready segment of this layout
+
+  const std::string name = "/" + sharedName; // shm_open() wants a leading slash
+  size_t count = mbSize * 1024 * 1024 / sizeof(Cluster);
+  size_t size  = sizeof(SharedHeader) + count * sizeof(Cluster);
+  bool created = true;
+
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST)
+  {
+      created = false;
+      fd = shm_open(name.c_str(), O_RDWR, 0600);
+  }
+
+  if (fd < 0)
+  {
+      sync_cout << "info string Unable to open shared hash " << sharedName << sync_endl;
+      return false;
+  }
+
+  struct stat sb;
+
+  // A new segment is zero filled by ftruncate(), so there is no need to clear it.
+  // An existing one may still be being sized by its creator, so wait a bit.
+  if (created && ftruncate(fd, off_t(size)))
+  {
+      close(fd);
+      shm_unlink(name.c_str());
+      sync_cout << "info string Unable to size shared hash " << sharedName << sync_endl;
+      return false;
+  }
+
+  for (int i = 0; !created && i < 1000; ++i)
+  {
+      if (!fstat(fd, &sb) && sb.st_size > off_t(sizeof(SharedHeader)))
+          break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  if (!created)
+      size = fstat(fd, &sb) ? 0 : size_t(sb.st_size);
+
+  void* mem = size ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+
+  if (mem == MAP_FAILED)
+  {
+      sync_cout << "info string Unable to map shared hash " << sharedName << sync_endl;
+      return false;
+  }
+
+  SharedHeader* header = static_cast<SharedHeader*>(mem);
+
+  if (created)
+  {
+      header->clusterCount = count;
+      header->owner = int32_t(getpid());
+      header->generation8 = 0;
+      header->magic.store(Magic, std::memory_order_release);
+  }
+  else
+      for (int i = 0; header->magic.load(std::memory_order_acquire) != Magic; ++i)
+      {
+          if (i == 1000 || (size - sizeof(SharedHeader)) / sizeof(Cluster) < header->clusterCount)
+          {
+              munmap(mem, size);
+              sync_cout << "info string Shared hash " << sharedName << " is not valid" << sync_endl;
+              return false;
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+
+  shared       = header;
+  sharedSize   = size;
+  clusterCount = header->clusterCount;
+  table        = reinterpret_cast<Cluster*>(header + 1);
+  generation8  = header->generation8;
+
+  sync_cout << "info string " << (created ? "Created" : "Attached to")
+            << " shared hash " << sharedName << " of "
+            << clusterCount * sizeof(Cluster) / (1024 * 1024) << "MB" << sync_endl;
+
+  return true;
+
+#endif
+}
+
+
+/// TranspositionTable::release() frees the private table or unmaps the shared one
+
+void TranspositionTable::release() {
+
+#if !defined(_WIN32)
+  if (shared)
+  {
+      munmap(shared, sharedSize);
+      shared = nullptr;
+      table = nullptr;
+      return;
+  }
+#endif
+
+  aligned_large_pages_free(table);
+  table = nullptr;
 }
 
 
 /// TranspositionTable::clear() initializes the entire transposition table to zero,
-//  in a multi-threaded way.
+//  in a multi-threaded way. A shared table is left untouched unless wipeShared is
+//  set, otherwise every 'ucinewgame' of one process would wipe the others' work.
+
+void TranspositionTable::clear(bool wipeShared) {
 
-void TranspositionTable::clear() {
+  if (shared && !wipeShared)
+      return;
 
   std::vector<std::thread> threads;
 
@@ -19,6 +19,9 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <atomic>
+#include <string>
+
 #include "misc.h"
 #include "types.h"
 
@@ -43,7 +46,7 @@ struct TTEntry {
   Depth depth() const { return (Depth)depth8 + DEPTH_OFFSET; }
   bool is_pv()  const { return (bool)(genBound8 & 0x4); }
   Bound bound() const { return (Bound)(genBound8 & 0x3); }
-  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
+  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8);
 
 private:
   friend class TranspositionTable;
@@ -61,7 +64,9 @@ private:
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty TTEntry
 /// contains information on exactly one position. The size of a Cluster should
 /// divide the size of a cache line for best performance, as the cacheline is
-/// prefetched when possible.
+/// prefetched when possible. Optionally the clusters can be placed in a named
+/// POSIX shared memory segment, so that several engine processes running on the
+/// same host search with one common table.
 
 class TranspositionTable {
 
@@ -80,13 +85,29 @@ class TranspositionTable {
   static constexpr int      GENERATION_CYCLE = 255 + (1 << GENERATION_BITS);     // cycle length
   static constexpr int      GENERATION_MASK  = (0xFF << GENERATION_BITS) & 0xFF; // mask to pull out generation number
 
+  // Header of a shared memory segment, followed by the clusters. The generation
+  // counter lives here so that all the attached processes age entries together,
+  // but only the owner process advances it, once per search of its own.
+  struct SharedHeader {
+    std::atomic<uint64_t> magic;
+    uint64_t clusterCount;
+    std::atomic<int32_t> owner;
+    std::atomic<uint8_t> generation8;
+    char padding[64 - 2 * sizeof(uint64_t) - sizeof(std::atomic<int32_t>) - sizeof(std::atomic<uint8_t>)];
+  };
+
+  static_assert(sizeof(SharedHeader) == 64, "Unexpected SharedHeader size");
+
 public:
- ~TranspositionTable() { aligned_large_pages_free(table); }
-  void new_search() { generation8 += GENERATION_DELTA; } // Lower bits are used for other things
+ ~TranspositionTable() { release(); }
+  void new_search();
   TTEntry* probe(const Key key, bool& found) const;
+  uint8_t generation() const { return generation8; }
   int hashfull() const;
   void resize(size_t mbSize);
-  void clear();
+  void clear(bool wipeShared = false);
+  void set_shared_name(const std::string& name);
+  bool is_shared() const { return shared != nullptr; }
 
   TTEntry* first_entry(const Key key) const {
     return &table[mul_hi64(key, clusterCount)].entry[0];
@@ -95,9 +116,16 @@ public:
 private:
   friend struct TTEntry;
 
-  size_t clusterCount;
-  Cluster* table;
-  uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
+  bool map_shared(size_t mbSize);
+  void release();
+  void rehash(const Cluster* oldTable, size_t oldCount);
+
+  size_t clusterCount = 0;
+  Cluster* table = nullptr;
+  uint8_t generation8 = 0; // Size must be not bigger than TTEntry::genBound8
+  SharedHeader* shared = nullptr;
+  size_t sharedSize = 0;
+  std::string sharedName;
 };
 
 extern TranspositionTable TT;
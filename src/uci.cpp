@@ -16,9 +16,14 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <deque>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <string>
 
@@ -31,6 +36,7 @@
 #include "timeman.h"
 #include "tt.h"
 #include "uci.h"
+#include "nlohmann/json.hpp"
 
 using namespace std;
 
@@ -42,6 +48,47 @@ namespace {
   const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
 
+  // A session is an independent game played through the shared thread pool,
+  // hash tables and static tables. Sessions keep their own position, option
+  // values, node accounting and search state (histories and time management
+  // memory), which are swapped in and out of the pool. Their searches run one
+  // after another, not concurrently.
+
+  struct Session {
+    string setup = "startpos";            // Arguments of the last position command
+    map<string, string, UCI::CaseInsensitiveLess> options;
+    int64_t availableNodes = 0;           // Clock in 'nodes as time' mode
+    TimePoint availableNodesRate = 0;     // and its nodes per ms
+    uint64_t nodes = 0, searches = 0;
+    GameState game;
+  };
+
+  map<string, Session> Sessions;
+  map<string, string, UCI::CaseInsensitiveLess> GlobalOptions; // Values overridden by sessions
+  string ActiveSession;
+  GameState UciGame;               // Search state of the game outside the sessions
+  bool ActiveSearched;
+  std::deque<string> SessionQueue; // Commands held back while a search awaits the GUI
+
+  // Options that size or configure the shared resources can't be per session
+  const char* SharedOptions[] = { "Threads", "Hash", "Pawn Hash", "Material Hash",
+                                  "Clear Hash", "Low Memory", "Spin Time" };
+
+
+  // The last position set up by position(). When the next command extends its
+  // move list, as a GUI does move after move in a game, only the new moves are
+  // played on the kept position and state list.
+
+  struct {
+    const Position* pos;
+    const std::deque<StateInfo>* states;
+    Key key;
+    bool chess960;
+    string fen;
+    vector<string> moves;
+  } LastPosition;
+
+
   // position() is called when the engine receives the "position" UCI command.
   // It sets up the position that is described in the given FEN string ("fen") or
   // the initial position ("startpos") and then makes the moves given in the following
@@ -51,6 +98,9 @@ namespace {
 
     Move m;
     string token, fen;
+    vector<string> moves;
+    size_t played = 0;
+    bool chess960 = Options["UCI_Chess960"];
 
     is >> token;
 
@@ -65,15 +115,35 @@ namespace {
     else
         return;
 
-    states = StateListPtr(new std::deque<StateInfo>(1)); // Drop the old state and create a new one
-    pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+    while (is >> token)
+        moves.push_back(token);
+
+    // The kept position must be untouched since, e.g. by 'flip'.
+    const auto& last = LastPosition;
+    if (    last.pos == &pos
+        &&  states
+        &&  last.states == states.get()
+        &&  last.key == pos.key()
+        &&  last.chess960 == chess960
+        &&  last.fen == fen
+        &&  moves.size() >= last.moves.size()
+        &&  std::equal(last.moves.begin(), last.moves.end(), moves.begin()))
+        played = last.moves.size();
+    else
+    {
+        states = StateListPtr(new std::deque<StateInfo>(1)); // Drop the old state and create a new one
+        pos.set(fen, chess960, &states->back(), nullptr); // No thread, so no nodes counted
+    }
 
-    // Parse the move list, if any
-    while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
+    // Play the new moves, if any, up to the first illegal one
+    for ( ; played < moves.size() && (m = UCI::to_move(pos, moves[played])) != MOVE_NONE; ++played)
     {
         states->emplace_back();
         pos.do_move(m, states->back());
     }
+
+    moves.resize(played);
+    LastPosition = { &pos, states.get(), pos.key(), chess960, fen, std::move(moves) };
   }
 
   // trace_eval() prints the evaluation of the current position, consistent with
@@ -107,7 +177,13 @@ namespace {
         value += (value.empty() ? "" : " ") + token;
 
     if (Options.count(name))
+    {
         Options[name] = value;
+
+        // Sessions that override the option fall back to the new value
+        if (GlobalOptions.count(name))
+            GlobalOptions[name] = value;
+    }
     else
         sync_cout << "No such option: " << name << sync_endl;
   }
@@ -143,7 +219,588 @@ namespace {
         else if (token == "infinite")  limits.infinite = 1;
         else if (token == "ponder")    ponderMode = true;
 
-    Threads.start_thinking(pos, states, limits, ponderMode);
+    // The search shares the state list, so that the next position command
+    // can extend it with the moves played meanwhile.
+    StateListPtr searchStates = states;
+    Threads.start_thinking(pos, searchStates, limits, ponderMode);
+  }
+
+
+  // hash_stats() prints the size and the hit rate of the pawn and material
+  // hash tables, summed over all the threads, since they were last resized.
+
+  void hash_stats(std::ostream& os) {
+
+    auto report = [&](const char* name, auto table) {
+        uint64_t probes = 0, hits = 0, size = 0;
+        for (Thread* th : Threads)
+        {
+            probes += (th->*table).probes;
+            hits   += (th->*table).hits;
+            size    = (th->*table).size();
+        }
+        os << name << size << " entries, " << probes << " probes, "
+           << (probes ? 1000 * hits / probes : 0) / 10.0 << "% hits";
+    };
+
+    report("Pawn hash       : ", &Thread::pawnsTable);
+    os << "\n";
+    report("Material hash   : ", &Thread::materialTable);
+  }
+
+
+  // perf_stats() prints the hardware counters of the search threads per node,
+  // summed over all the threads, then for each thread if there are several.
+  // When the counters cannot be opened, it says why only the first time.
+
+  void perf_stats(std::ostream& os, const std::deque<PerfCounters>& counters,
+                  const vector<uint64_t>& threadNodes) {
+
+    if (counters.empty())
+        return;
+
+    if (std::none_of(counters.begin(), counters.end(), [](const PerfCounters& pc) {
+                     return pc.available(PerfCounters::CYCLES) || pc.available(PerfCounters::INSTRUCTIONS); }))
+    {
+        static bool warned = false;
+        if (!warned)
+            os << "\nHW counters     : not available (" << counters[0].error() << ")";
+        warned = true;
+        return;
+    }
+
+    auto report = [&](const string& name, size_t first, size_t last) {
+
+        uint64_t n = 0, v[PerfCounters::EVENT_NB] = {};
+        bool available[PerfCounters::EVENT_NB] = {};
+
+        for (size_t i = first; i < last; ++i)
+        {
+            n += threadNodes[i];
+            for (int e = 0; e < PerfCounters::EVENT_NB; ++e)
+                if (counters[i].available(PerfCounters::Event(e)))
+                    available[e] = true, v[e] += counters[i].read(PerfCounters::Event(e));
+        }
+
+        auto perNode = [&](PerfCounters::Event e) {
+            std::ostringstream ss;
+            if (available[e])
+                ss << std::fixed << std::setprecision(2) << double(v[e]) / std::max(n, uint64_t(1));
+            else
+                ss << "N/A";
+            return ss.str();
+        };
+
+        os << "\n" << name
+           << "IPC " << (available[PerfCounters::CYCLES] && available[PerfCounters::INSTRUCTIONS] && v[PerfCounters::CYCLES]
+                         ? std::to_string(double(v[PerfCounters::INSTRUCTIONS]) / v[PerfCounters::CYCLES]).substr(0, 4) : "N/A")
+           << ", per node: "
+           << perNode(PerfCounters::INSTRUCTIONS)  << " instructions, "
+           << perNode(PerfCounters::CYCLES)        << " cycles, "
+           << perNode(PerfCounters::CACHE_MISSES)  << " cache misses, "
+           << perNode(PerfCounters::BRANCH_MISSES) << " branch misses, "
+           << perNode(PerfCounters::DTLB_MISSES)   << " dTLB misses";
+    };
+
+    report("HW counters     : ", 0, counters.size());
+
+    if (counters.size() > 1)
+        for (size_t i = 0; i < counters.size(); ++i)
+        {
+            string label = "  thread " + std::to_string(i);
+            report(label + string(16 - std::min(size_t(15), label.size()), ' ') + ": ", i, i + 1);
+        }
+  }
+
+
+  // session_settle() waits for the running session search, if any, and
+  // charges its nodes to the session that started it.
+
+  void session_settle() {
+
+    Threads.main()->wait_for_search_finished();
+
+    if (ActiveSearched && Sessions.count(ActiveSession))
+    {
+        Session& s = Sessions[ActiveSession];
+        s.nodes += Threads.nodes_searched();
+        s.availableNodes = Time.availableNodes;
+        s.availableNodesRate = Time.availableNodesRate;
+        ++s.searches;
+    }
+    ActiveSearched = false;
+  }
+
+
+  // session_activate() switches the global options, the 'nodes as time' clock
+  // and the search state of the pool from the active session to the given one.
+
+  void session_activate(const string& id) {
+
+    session_settle();
+
+    if (id == ActiveSession)
+        return;
+
+    if (Sessions.count(ActiveSession))
+    {
+        Session& prev = Sessions[ActiveSession];
+        prev.availableNodes = Time.availableNodes;
+        prev.availableNodesRate = Time.availableNodesRate;
+
+        for (const auto& [name, value] : prev.options)
+            if (!Sessions[id].options.count(name))
+                Options[name] = GlobalOptions[name];
+    }
+
+    for (const auto& [name, value] : Sessions[id].options)
+        Options[name] = value;
+
+    Threads.save_game(Sessions.count(ActiveSession) ? Sessions[ActiveSession].game : UciGame);
+    Threads.load_game(Sessions[id].game);
+
+    Time.availableNodes = Sessions[id].availableNodes;
+    Time.availableNodesRate = Sessions[id].availableNodesRate;
+    ActiveSession = id;
+  }
+
+
+  // search_awaits_gui() is true while the running search, an infinite or a
+  // ponder search, only ends on a 'stop' or 'ponderhit' from the GUI.
+
+  bool search_awaits_gui() {
+    return !Threads.stop && (Search::Limits.infinite || Threads.main()->ponder);
+  }
+
+
+  // session_run() carries out a session command, see session()
+
+  void session_run(istringstream& is) {
+
+    string token, id;
+
+    is >> token;
+
+    if (token == "new" || token == "close")
+    {
+        is >> id;
+
+        if (token == "new" && !id.empty() && !Sessions.count(id))
+            Sessions[id];
+
+        else if (token == "close" && Sessions.count(id))
+        {
+            if (id == ActiveSession)
+            {
+                session_settle();
+
+                // Hand back the global values the closed session had changed
+                for (const auto& [name, value] : Sessions[id].options)
+                    Options[name] = GlobalOptions[name];
+
+                Threads.load_game(UciGame);
+                ActiveSession.clear();
+            }
+            Sessions.erase(id);
+        }
+        else
+            sync_cout << "info string Invalid session " << id << sync_endl;
+
+        return;
+    }
+
+    // Nodes of a running search are charged once it is settled
+    if (token == "list")
+    {
+        for (const auto& [name, s] : Sessions)
+            sync_cout << "info string session " << name
+                      << " searches " << s.searches
+                      << " nodes "    << s.nodes
+                      << (name == ActiveSession ? " active" : "") << sync_endl;
+        return;
+    }
+
+    if (!Sessions.count(token))
+    {
+        sync_cout << "info string Unknown session " << token << sync_endl;
+        return;
+    }
+
+    Session& s = Sessions[id = token];
+    is >> token;
+
+    if (token == "position")
+    {
+        string setup;
+        getline(is >> ws, setup);
+
+        if (setup.rfind("startpos", 0) == 0 || setup.rfind("fen ", 0) == 0)
+            s.setup = setup;
+        else
+            sync_cout << "info string Invalid position for session " << id << sync_endl;
+    }
+
+    else if (token == "ucinewgame")
+    {
+        s.setup = "startpos";
+        s.availableNodes = 0;
+        s.game = GameState();
+
+        if (id == ActiveSession)
+        {
+            session_settle();
+            Time.availableNodes = 0;
+            Threads.load_game(s.game);
+        }
+    }
+
+    else if (token == "setoption")
+    {
+        string name, value;
+
+        is >> token; // Consume the "name" token
+
+        while (is >> token && token != "value")
+            name += (name.empty() ? "" : " ") + token;
+
+        while (is >> token)
+            value += (value.empty() ? "" : " ") + token;
+
+        if (!Options.count(name))
+            sync_cout << "No such option: " << name << sync_endl;
+
+        else if (std::any_of(std::begin(SharedOptions), std::end(SharedOptions),
+                             [&](const char* o) { return !UCI::CaseInsensitiveLess()(o, name)
+                                                      && !UCI::CaseInsensitiveLess()(name, o); }))
+            sync_cout << "info string " << name << " is shared by all sessions" << sync_endl;
+
+        else
+        {
+            // Remember the global value the first time any session overrides it
+            if (!GlobalOptions.count(name))
+                GlobalOptions[name] = Options[name].current();
+
+            s.options[name] = value;
+
+            if (id == ActiveSession)
+            {
+                session_settle();
+                Options[name] = value;
+            }
+        }
+    }
+
+    else if (token == "go" || token == "d")
+    {
+        Position pos;
+        StateListPtr states;
+        istringstream setup(s.setup);
+
+        if (token == "d")
+        {
+            position(pos, setup, states);
+            sync_cout << pos << sync_endl;
+            return;
+        }
+
+        session_activate(id);
+        position(pos, setup, states);
+
+        sync_cout << "info string session " << id << sync_endl;
+        ActiveSearched = true;
+        go(pos, is, states);
+    }
+
+    else
+        sync_cout << "info string Unknown session command " << token << sync_endl;
+  }
+
+
+  // session() is called when the engine receives the "session" command. It
+  // manages many games in one process:
+  //   session new <id> | close <id> | list
+  //   session <id> position|setoption|go|ucinewgame|d ...
+  // The searches of the sessions run one after another on the shared pool, as
+  // the search limits, the stop flag and the options are global. So while a
+  // search awaits 'stop' or 'ponderhit', session commands are queued, as waiting
+  // for it here would stop the loop from reading that very command.
+  // session_drain() runs them, in order, once the search can end on its own.
+
+  void session(istringstream& is) {
+
+    string token;
+    istringstream peek(is.str());
+    peek >> token >> token; // The subcommand or the session id
+
+    if (token != "list" && (search_awaits_gui() || !SessionQueue.empty()))
+    {
+        SessionQueue.push_back(is.str());
+        sync_cout << "info string session command queued until the search ends" << sync_endl;
+        return;
+    }
+
+    session_run(is);
+  }
+
+  void session_drain() {
+
+    while (!SessionQueue.empty() && !search_awaits_gui())
+    {
+        istringstream is(SessionQueue.front());
+        string token;
+
+        SessionQueue.pop_front();
+        is >> token; // Consume "session"
+        session_run(is);
+    }
+  }
+
+
+  // fen_error() tells why Position::set() can't safely set up the given FEN,
+  // or returns nullptr if it can. The board must have eight ranks of eight
+  // squares, one king of each color and no pawn on the first or last rank, and
+  // a castling right needs the king and a rook of its color on its first rank.
+
+  const char* fen_error(const string& fen) {
+
+    istringstream ss(fen);
+    string board, side, castling;
+    char grid[8][8] = {}; // [rank][file]
+    int rank = 7, file = 0;
+
+    ss >> board >> side >> castling;
+
+    for (char c : board)
+        if (c == '/')
+        {
+            if (file != 8 || rank-- == 0)
+                return "bad piece placement";
+            file = 0;
+        }
+        else if (c >= '1' && c <= '8' && file + c - '0' <= 8)
+            file += c - '0';
+        else if (string("PNBRQKpnbrqk").find(c) != string::npos && file < 8)
+            grid[rank][file++] = c;
+        else
+            return "bad piece placement";
+
+    if (rank || file != 8)
+        return "bad piece placement";
+
+    if (   std::count(&grid[0][0], &grid[0][0] + 64, 'K') != 1
+        || std::count(&grid[0][0], &grid[0][0] + 64, 'k') != 1)
+        return "not one king of each color";
+
+    for (char c : { 'P', 'p' })
+        if (std::count(grid[0], grid[0] + 8, c) || std::count(grid[7], grid[7] + 8, c))
+            return "pawn on the first or last rank";
+
+    if (side != "w" && side != "b")
+        return "bad side to move";
+
+    for (char c : castling)
+    {
+        if (c == '-')
+            continue;
+
+        const char* firstRank = islower(c) ? grid[7] : grid[0];
+        char rook = islower(c) ? 'r' : 'R', king = islower(c) ? 'k' : 'K';
+        c = char(toupper(c));
+
+        if (   !std::count(firstRank, firstRank + 8, king)
+            || (c == 'K' || c == 'Q' ? !std::count(firstRank, firstRank + 8, rook)
+                                     : c < 'A' || c > 'H' || firstRank[c - 'A'] != rook))
+            return "bad castling rights";
+    }
+
+    return nullptr;
+  }
+
+
+  // analyze() is called when the engine receives the "analyze" command:
+  //   analyze <file> [depth N] [nodes N] [threads T] [hash MB]
+  // The positions of an EPD or FEN file are spread over T threads, each one
+  // searching a position on its own with a TT of its own, of the given size,
+  // so that a result doesn't depend on what the other threads searched before.
+  // A JSON line is printed for each position as soon as it is done, so lines
+  // are not in file order. Positions that can't be searched get an error line.
+
+  void analyze(istringstream& is) {
+
+    string file, token;
+    Depth depth = 0;
+    uint64_t nodes = 0;
+    size_t threads = 1, hashMB = 16;
+
+    is >> file;
+
+    while (is >> token)
+        if (token == "depth")        is >> depth;
+        else if (token == "nodes")   is >> nodes;
+        else if (token == "threads") is >> threads;
+        else if (token == "hash")    is >> hashMB;
+
+    ifstream in(file);
+    vector<string> epd;
+
+    while (getline(in, token))
+        if (token.find_first_not_of(" \t\r") != string::npos && token[0] != '#')
+            epd.push_back(token);
+
+    if (epd.empty())
+    {
+        sync_cout << "info string No positions in " << file << sync_endl;
+        return;
+    }
+
+    if (!depth && !nodes)
+        depth = 10;
+
+    // The main thread only waits, the helpers do the searches
+    threads = std::clamp(threads, size_t(1), size_t(1023));
+    size_t poolSize = Threads.size();
+
+    Threads.main()->wait_for_search_finished();
+    if (poolSize != threads + 1)
+        Threads.set(threads + 1);
+
+    Search::LimitsType limits;
+    limits.startTime = now();
+    Search::Limits = limits;
+    Threads.stop = false;
+    Threads.increaseDepth = true;
+
+    std::deque<TranspositionTable> tables(threads);
+    for (TranspositionTable& tt : tables)
+        tt.resize(std::clamp(hashMB, size_t(1), size_t(1) << 20));
+
+    bool chess960 = Options["UCI_Chess960"];
+    atomic<size_t> next(0);
+    atomic<uint64_t> totalNodes(0);
+
+    auto work = [&](Thread* th) {
+
+        for (size_t n; (n = next++) < epd.size(); )
+        {
+            // Four FEN fields, then optional move counters or EPD operations
+            istringstream line(epd[n]);
+            string fen, id, op, field;
+
+            for (int i = 0; i < 6 && line >> field; ++i)
+                if (i < 4 || field.find_first_not_of("0123456789") == string::npos)
+                    fen += field + " ";
+                else
+                {
+                    op = field;
+                    break;
+                }
+
+            do
+                if (op == "id" && line >> quoted(id) && !id.empty() && id.back() == ';')
+                    id.pop_back();
+            while (line >> op);
+
+            TimePoint start = now();
+            const char* error = fen_error(fen);
+
+            if (!error)
+            {
+                th->rootPos.set(fen, chess960, &th->rootState, th);
+
+                Color us = th->rootPos.side_to_move();
+                if (th->rootPos.attackers_to(th->rootPos.square<KING>(~us)) & th->rootPos.pieces(us))
+                    error = "side not to move is in check";
+            }
+
+            if (error)
+            {
+                nlohmann::ordered_json j = { { "n", n + 1 }, { "fen", fen.substr(0, fen.size() - 1) } };
+
+                if (!id.empty())
+                    j["id"] = id;
+
+                j["error"] = error;
+                sync_cout << j.dump() << sync_endl;
+                continue;
+            }
+
+            th->rootMoves.clear();
+            for (const auto& m : MoveList<LEGAL>(th->rootPos))
+                th->rootMoves.emplace_back(m);
+
+            th->nodes = th->tbHits = th->nmpMinPly = th->bestMoveChanges = 0;
+            th->rootDepth = th->completedDepth = 0;
+            th->maxNodesHit = false;
+            th->tt->new_search();
+
+            nlohmann::ordered_json j = { { "n", n + 1 }, { "fen", th->rootPos.fen() } };
+
+            if (!id.empty())
+                j["id"] = id;
+
+            if (th->rootMoves.empty())
+            {
+                j["bestmove"] = nullptr;
+                j["score"] = { { th->rootPos.checkers() ? "mate" : "cp", 0 } };
+            }
+            else
+            {
+                th->Thread::search();
+
+                const Search::RootMove& rm = th->rootMoves[0];
+                istringstream score(UCI::value(rm.uciScore != -VALUE_INFINITE ? rm.uciScore : rm.previousScore));
+                string kind;
+                int value;
+                score >> kind >> value;
+
+                vector<string> pv;
+                for (Move m : rm.pv)
+                    pv.push_back(UCI::move(m, chess960));
+
+                j["bestmove"] = pv[0];
+                j["score"] = { { kind, value } };
+                j["depth"] = int(th->completedDepth);
+                j["pv"] = pv;
+            }
+
+            j["nodes"] = th->nodes.load();
+            j["time"] = now() - start;
+            totalNodes += th->nodes;
+
+            sync_cout << j.dump() << sync_endl;
+        }
+    };
+
+    TimePoint elapsed = now();
+
+    for (Thread* th : Threads)
+        if (th != Threads.main())
+        {
+            th->maxDepth = depth;
+            th->maxNodes = nodes;
+            th->tt = &tables[th->id() - 1];
+            th->run_custom_job([&work, th]() { work(th); });
+        }
+
+    for (Thread* th : Threads)
+    {
+        th->wait_for_search_finished();
+        th->maxDepth = 0;
+        th->maxNodes = 0;
+        th->maxNodesHit = false;
+        th->tt = &TT;
+    }
+
+    elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+
+    if (poolSize != Threads.size())
+        Threads.set(poolSize);
+
+    cerr << "\n==========================="
+         << "\nPositions       : " << epd.size()
+         << "\nTotal time (ms) : " << elapsed
+         << "\nNodes searched  : " << totalNodes
+         << "\nNodes/second    : " << 1000 * totalNodes / elapsed << endl;
   }
 
 
@@ -159,6 +816,11 @@ namespace {
     vector<string> list = setup_bench(pos, args);
     num = count_if(list.begin(), list.end(), [](const string& s) { return s.find("go ") == 0 || s.find("eval") == 0; });
 
+    // Hardware counters of each search thread, opened by the thread itself
+    // once the pool has its final size, that is before the first search.
+    std::deque<PerfCounters> counters;
+    vector<uint64_t> threadNodes;
+
     TimePoint elapsed = now();
 
     for (const auto& cmd : list)
@@ -171,9 +833,30 @@ namespace {
             cerr << "\nPosition: " << cnt++ << '/' << num << " (" << pos.fen() << ")" << endl;
             if (token == "go")
             {
+               if (counters.empty())
+               {
+                   for (Thread* th : Threads)
+                   {
+                       PerfCounters& pc = counters.emplace_back();
+                       th->run_custom_job([&pc]() { pc.open(); });
+                   }
+
+                   for (Thread* th : Threads)
+                       th->wait_for_search_finished();
+
+                   threadNodes.resize(counters.size());
+                   Search::stats_clear();
+                   Eval::profile_clear();
+               }
+
                go(pos, is, states);
                Threads.main()->wait_for_search_finished();
                nodes += Threads.nodes_searched();
+
+               size_t i = 0;
+               for (Thread* th : Threads)
+                   if (i < threadNodes.size())
+                       threadNodes[i++] += th->nodes;
             }
             else
                trace_eval(pos);
@@ -191,6 +874,18 @@ namespace {
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
          << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+
+    hash_stats(cerr);
+    perf_stats(cerr, counters, threadNodes);
+#ifdef SEARCH_STATS
+    cerr << "\n";
+    Search::stats_print(cerr, false);
+#endif
+#ifdef EVAL_PROFILE
+    cerr << "\n";
+    Eval::profile_print(cerr);
+#endif
+    cerr << endl;
   }
 
   // The win rate model returns the probability of winning (in per mille units) given an
@@ -230,7 +925,7 @@ void UCI::loop(int argc, char* argv[]) {
   string token, cmd;
   StateListPtr states(new std::deque<StateInfo>(1));
 
-  pos.set(StartFEN, false, &states->back(), Threads.main());
+  pos.set(StartFEN, false, &states->back(), nullptr);
 
   for (int i = 1; i < argc; ++i)
       cmd += std::string(argv[i]) + " ";
@@ -246,14 +941,20 @@ void UCI::loop(int argc, char* argv[]) {
 
       if (    token == "quit"
           ||  token == "stop")
+      {
           Threads.stop = true;
+          Threads.main()->wake_up();
+      }
 
       // The GUI sends 'ponderhit' to tell that the user has played the expected move.
       // So, 'ponderhit' is sent if pondering was done on the same move that the user
       // has played. The search should continue, but should also switch from pondering
       // to the normal search.
       else if (token == "ponderhit")
+      {
           Threads.main()->ponder = false; // Switch to the normal search
+          Threads.main()->wake_up();
+      }
 
       else if (token == "uci")
           sync_cout << "id name " << engine_info(true)
@@ -264,14 +965,37 @@ void UCI::loop(int argc, char* argv[]) {
       else if (token == "go")         go(pos, is, states);
       else if (token == "position")   position(pos, is, states);
       else if (token == "ucinewgame") Search::clear();
+      else if (token == "session")    session(is);
       else if (token == "isready")    sync_cout << "readyok" << sync_endl;
 
       // Add custom non-UCI commands, mainly for debugging purposes.
       // These commands must not be used during a search!
       else if (token == "flip")     pos.flip();
       else if (token == "bench")    bench(pos, is, states);
+      else if (token == "benchsuite") bench_suite(is);
+      else if (token == "analyze")  analyze(is);
       else if (token == "d")        sync_cout << pos << sync_endl;
       else if (token == "eval")     trace_eval(pos);
+      else if (token == "memory")   sync_cout << "info string Memory " << SysInfo::process_memory() << sync_endl;
+      else if (token == "hashstats") { sync_cout; hash_stats(cout); cout << sync_endl; }
+      else if (token == "timestats")
+      {
+          if (is >> token && token == "reset")
+              Time.stats.clear();
+          else
+          {
+              sync_cout; Time.stats.print(cout); cout << sync_endl;
+          }
+      }
+      else if (token == "searchstats")
+      {
+          if (is >> token && token == "reset")
+              Search::stats_clear();
+          else
+          {
+              sync_cout; Search::stats_print(cout, true); cout << sync_endl;
+          }
+      }
       else if (token == "compiler") sync_cout << compiler_info() << sync_endl;
       else if (token == "--help" || token == "help" || token == "--license" || token == "license")
           sync_cout << "\nHypnos is a powerful chess engine for playing and analyzing."
@@ -283,7 +1007,18 @@ void UCI::loop(int argc, char* argv[]) {
       else if (!token.empty() && token[0] != '#')
           sync_cout << "Unknown command: '" << cmd << "'. Type help for more information." << sync_endl;
 
+      if (token != "quit")
+          session_drain();
+
   } while (token != "quit" && argc == 1); // The command-line arguments are one-shot
+
+  // Leave the time statistics of the session in the log
+  if (argc == 1 && Time.stats.moves)
+  {
+      Threads.main()->wait_for_search_finished();
+      Time.stats.print(cerr);
+      cerr << endl;
+  }
 }
 
 
@@ -367,11 +1102,51 @@ Move UCI::to_move(const Position& pos, string& str) {
   if (str.length() == 5)
       str[4] = char(tolower(str[4])); // The promotion piece character must be lowercased
 
-  for (const auto& m : MoveList<LEGAL>(pos))
-      if (str == UCI::move(m, pos.is_chess960()))
-          return m;
+  if (   (str.length() != 4 && str.length() != 5)
+      || str[0] < 'a' || str[0] > 'h' || str[1] < '1' || str[1] > '8'
+      || str[2] < 'a' || str[2] > 'h' || str[3] < '1' || str[3] > '8')
+      return MOVE_NONE;
+
+  // Build the move from its squares and check it, instead of generating all
+  // the legal moves and formatting each of them for comparison.
+  Square from = make_square(File(str[0] - 'a'), Rank(str[1] - '1'));
+  Square to   = make_square(File(str[2] - 'a'), Rank(str[3] - '1'));
+  Color us = pos.side_to_move();
+  Piece pc = pos.piece_on(from);
+  Move m;
+
+  if (from == to)
+      return MOVE_NONE;
+
+  if (str.length() == 5)
+  {
+      size_t pt = string("nbrq").find(str[4]);
+      if (pt == string::npos)
+          return MOVE_NONE;
+
+      m = make<PROMOTION>(from, to, PieceType(KNIGHT + pt));
+  }
+  else if (type_of(pc) == PAWN && to == pos.ep_square())
+      m = make<EN_PASSANT>(from, to);
+
+  else
+      m = make_move(from, to);
+
+  // Castling is written as the king taking its rook in Chess960, else as the
+  // king going to the g or c file. The latter can also be a plain king move.
+  if (   type_of(pc) == KING
+      && str.length() == 4
+      && (pos.is_chess960() ? pos.piece_on(to) == make_piece(us, ROOK)
+                            : rank_of(to) == rank_of(from) && (file_of(to) == FILE_G || file_of(to) == FILE_C)))
+  {
+      Move castling = make<CASTLING>(from, pos.is_chess960() ? to
+                                         : pos.castling_rook_square(us & (to > from ? KING_SIDE : QUEEN_SIDE)));
+
+      if (pos.pseudo_legal(castling) && pos.legal(castling))
+          return castling;
+  }
 
-  return MOVE_NONE;
+  return pos.pseudo_legal(m) && pos.legal(m) ? m : MOVE_NONE;
 }
 
 } // namespace Stockfish
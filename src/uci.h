@@ -57,6 +57,7 @@ public:
   operator int() const;
   operator std::string() const;
   bool operator==(const char*) const;
+  const std::string& current() const { return currentValue; }
 
 private:
   friend std::ostream& operator<<(std::ostream&, const OptionsMap&);
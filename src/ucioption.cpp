@@ -28,6 +28,7 @@
 #include "misc.h"
 #include "search.h"
 #include "thread.h"
+#include "timeman.h"
 #include "tt.h"
 #include "uci.h"
 #include "polybook.h"
@@ -124,8 +125,25 @@ void sync_uci_options() {
 }
 
 /// 'On change' actions, triggered by an option's value change
-static void on_clear_hash(const Option&) { Search::clear(); }
-static void on_hash_size(const Option& o) { TT.resize(size_t(o)); }
+static void on_clear_hash(const Option&) { Search::clear(); if (TT.is_shared()) TT.clear(true); }
+static void on_hash_size(const Option& o) { if (!Threads.empty()) TT.resize(size_t(o)); }
+static void on_shared_hash(const Option& o) { TT.set_shared_name(o); }
+static void on_eval_hash(const Option&) { if (!Threads.empty()) Threads.resize_eval_tables(); }
+
+// The low memory profile is meant for hosting many engine instances per host.
+// Its table sizes are applied once, and can be overridden afterwards.
+static void on_low_memory(const Option& o) {
+
+  allow_large_pages(!o);
+
+  if (o)
+  {
+      Options["Hash"] = std::string("1");
+      Options["Pawn Hash"] = std::string("256");
+      Options["Material Hash"] = std::string("64");
+  }
+}
+static void on_spin_time(const Option& o) { Threads.spinTime = int(o); }
 static void on_logger(const Option& o) { start_logger(o); }
 static void on_threads(const Option& o) { Threads.set(size_t(o)); }
 
@@ -248,10 +266,19 @@ void init(OptionsMap& o) {
     o["Threads"]               << Option(1, 1, 1024, on_threads);
     o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
     o["Clear Hash"]            << Option(on_clear_hash);
+    o["Shared Hash"]           << Option("<empty>", on_shared_hash);
+    o["Pawn Hash"]             << Option(12288, 16, 1048576, on_eval_hash);
+    o["Material Hash"]         << Option(320, 16, 1048576, on_eval_hash);
+    o["Perft Hash"]            << Option(0, 0, MaxHashMB);
+    o["Low Memory"]            << Option(false, on_low_memory);
+    o["ABDADA"]                << Option(false);
+    o["Spin Time"]             << Option(0, 0, 100000, on_spin_time);
     o["Ponder"]                << Option(false);
     o["MultiPV"]               << Option(1, 1, 500);
+    o["MultiPV One Pass"]      << Option(false);
     o["Skill Level"]           << Option(20, 0, 20);
     o["Move Overhead"]         << Option(10, 0, 5000);
+    o["Calibrate Time"]        << Option(false);
     o["Slow Mover"]            << Option(100, 10, 1000);
     o["nodestime"]             << Option(0, 0, 10000);
     o["UCI_Chess960"]          << Option(false);
@@ -278,7 +305,7 @@ void init(OptionsMap& o) {
     o["KnightPair"]            << Option(0, 0, 50, [](const Option& v) { activePersonality.set_param("KnightPair", int(v)); });
     o["BishopPair"]            << Option(0, 0, 50, [](const Option& v) { activePersonality.set_param("BishopPair", int(v)); });
     o["Defense"]               << Option(0, 0, 50, [](const Option& v) { activePersonality.set_param("Defense", int(v)); });
-    o["CalculationDepth"]      << Option(0, 0, 18, [](const Option& v) { activePersonality.set_param("CalculationDepth", int(v)); }); 
+    o["CalculationDepth"]      << Option(0, 0, MaxCalculationDepth, [](const Option& v) { activePersonality.set_param("CalculationDepth", int(v)); }); 
     o["EndgameKnowledge"]      << Option(0, 0, 50, [](const Option& v) { activePersonality.set_param("EndgameKnowledge", int(v)); });
     o["PieceSacrifice"]        << Option(0, 0, 50, [](const Option& v) { activePersonality.set_param("PieceSacrifice", int(v)); });
     o["CenterControl"]         << Option(0, 0, 50, [](const Option& v) { activePersonality.set_param("CenterControl", int(v)); });